@@ -44,6 +44,10 @@ typedef enum {
 	REN_BGR24,   /**< Packed BGR888 */
 	REN_RGB32,   /**< Packed XRGB8888 (most significant byte ignored) */
 	REN_ARGB32,  /**< Packed ARGB8888 */
+	REN_PAL8,    /**< 8-bit index into a palette of ARGB8888 colours */
+	REN_YUYV,    /**< YCbCr422: Packed Y0 Cb Y1 Cr, input only */
+	REN_UYVY,    /**< YCbCr422: Packed Cb Y0 Cr Y1, input only */
+	REN_NV21,    /**< YCbCr420: Y plane, packed CrCb plane, input only */
 } ren_vid_format_t;
 
 
@@ -85,18 +89,24 @@ static const struct format_info fmts[] = {
 	{ REN_BGR24,   3, 0, 0, 1, 1, 1 },
 	{ REN_RGB32,   4, 0, 0, 1, 1, 1 },
 	{ REN_ARGB32,  4, 0, 0, 1, 1, 1 },
+	{ REN_PAL8,    1, 0, 0, 1, 1, 1 },
+	{ REN_YUYV,    2, 0, 0, 1, 2, 1 },
+	{ REN_UYVY,    2, 0, 0, 1, 2, 1 },
+	{ REN_NV21,    1, 2, 1, 2, 2, 2 },
 };
 
 static inline int is_ycbcr(ren_vid_format_t fmt)
 {
 	if (fmt >= REN_NV12 && fmt <= REN_NV16)
 		return 1;
+	if (fmt >= REN_YUYV && fmt <= REN_NV21)
+		return 1;
 	return 0;
 }
 
 static inline int is_rgb(ren_vid_format_t fmt)
 {
-	if (fmt >= REN_RGB565 && fmt <= REN_ARGB32)
+	if (fmt >= REN_RGB565 && fmt <= REN_PAL8)
 		return 1;
 	return 0;
 }
@@ -270,14 +280,63 @@ extern "C" {
 struct SHBEU;
 typedef struct SHBEU SHBEU;
 
+/**
+ * The plane addresses of the surface are bus addresses, see shbeu_surface.
+ */
+#define SHBEU_PHYS (1 << 0)
+
+/**
+ * The planes of the surface hold a tile that is repeated, see shbeu_surface.
+ */
+#define SHBEU_TILE (1 << 1)
+
+/**
+ * Pixels of the key colour of the surface are transparent, see shbeu_surface.
+ */
+#define SHBEU_KEY (1 << 2)
+
 /**
  * Surface specification.
+ * Unused fields must be zero, so surfaces should be cleared, for example
+ * with memset() or an initialiser, before the fields are set. The fields
+ * after y were added in version 3 of the library interface.
+ * With SHBEU_PHYS, the plane addresses are given to the hardware as they
+ * are, so the memory is never copied. Such surfaces cannot be read or
+ * written by the CPU, so they cannot be used with SHBEU_CPU, or for
+ * surfaces that are not a multiple of 4 pixels, or with a pitch the
+ * hardware cannot use.
+ * With SHBEU_TILE, the planes hold a single tile_w x tile_h tile, which is
+ * repeated from the top left corner to fill the w x h surface. Only the
+ * parent surface (src1) can be tiled, and the tile size must be a multiple
+ * of 4 pixels. The pitch is that of the tile. The tile is repeated as it
+ * is read, except when the hardware cannot do the blend in a single pass;
+ * then the whole surface is filled in from the tile in a bounce buffer.
+ * With SHBEU_KEY, pixels that match the key colour are transparent, so an
+ * overlay needs no alpha data to have holes. Only RGB overlays (src2 and
+ * src3) can be keyed. The key is compared at the precision of the format,
+ * so for RGB565 only the top 5, 6 and 5 bits of each component are used.
+ * REN_PAL8 surfaces have a palette of 256 colours, as 0xAARRGGBB, and the
+ * alpha of each colour is the alpha of the pixels that use it. The BEU has
+ * a single palette, which is only loaded when it changes, or when the BEU
+ * has been reset or used by another handle since it was loaded. A blend that
+ * needs a different palette waits for the queued blends to complete before
+ * it is loaded. All REN_PAL8 inputs of a blend must have the same palette,
+ * and REN_PAL8 cannot be used for windows or the output.
+ * The BEU cannot read REN_YUYV, REN_UYVY and REN_NV21, so inputs in these
+ * formats are converted to REN_NV16 or REN_NV12 as they are copied to a
+ * bounce buffer. They cannot be physical surfaces, and are not used for
+ * the output.
  */
 struct shbeu_surface {
 	struct ren_vid_surface s; /**< surface */
 	unsigned char alpha;/**< Fixed alpha value [0..255] for entire surface. Only used if pa=0. 0=transparent, 255=opaque */
 	int x;              /**< Overlay position (horizontal) (ignored for destination surface) */
 	int y;              /**< Overlay position (vertical) (ignored for destination surface) */
+	int flags;          /**< 0, or any of SHBEU_PHYS, SHBEU_TILE and SHBEU_KEY */
+	int tile_w;         /**< Width of the tile in pixels, only used with SHBEU_TILE */
+	int tile_h;         /**< Height of the tile in pixels, only used with SHBEU_TILE */
+	unsigned int key;   /**< Transparent colour as 0xRRGGBB, only used with SHBEU_KEY */
+	const unsigned int *palette; /**< 256 colours as 0xAARRGGBB, only used for REN_PAL8 */
 };
 
 
@@ -287,11 +346,19 @@ struct shbeu_surface {
  */
 SHBEU *shbeu_open(void);
 
+/**
+ * Name of the software blend implementation, see shbeu_open_named().
+ */
+#define SHBEU_CPU "cpu"
+
 /**
  * Open a BEU device with the specified name.
  * If more than one BEU is available on the platform, each BEU
  * has a name such as 'BEU0', 'BEU1', and so on. This API will allow
  * to open a specific BEU by shbeu_open_named("BEU0") for instance.
+ * The name SHBEU_CPU opens a software implementation that produces the same
+ * output as the BEU. It does not need any hardware, and blends are complete
+ * when shbeu_start_blend() returns.
  * \retval 0 Failure, otherwise BEU handle.
  */
 SHBEU *shbeu_open_named(const char *name);
@@ -302,7 +369,115 @@ SHBEU *shbeu_open_named(const char *name);
  */
 void shbeu_close(SHBEU *beu);
 
+/**
+ * Set the limits of the bounce buffer pool.
+ * Surfaces that the hardware cannot access are copied to temporary buffers.
+ * These buffers are kept by the BEU handle and reused by later blends.
+ * Buffers are grouped by size; at most max_per_size buffers of each size are
+ * kept, and at most max_bytes in total. By default, 144 buffers of each size
+ * are kept, enough for every plane of the blends in flight: two queued on
+ * the BEU, and four waiting for their output to be copied back.
+ * \param beu BEU handle
+ * \param max_per_size Number of buffers kept for each size [0..144], 0=no pooling
+ * \param max_bytes Total size of the kept buffers, 0=no limit
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_set_bounce_limits(SHBEU *beu, int max_per_size, size_t max_bytes);
+
+/**
+ * Preallocate bounce buffers.
+ * Adds buffers suitable for the specified surface to the bounce buffer
+ * pool, so that blends do not need to allocate memory. Each plane gets its
+ * own buffers, and each call adds more, so call it once for each surface
+ * that will be bounced. Typically called immediately after opening the BEU.
+ * \param beu BEU handle
+ * \param surface Surface that will be blended. Only the format, size and
+ * the presence of each plane are used.
+ * \param count Number of buffers for each plane. Up to six blends can hold
+ * bounce buffers at once, see shbeu_set_bounce_limits().
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_prealloc_bounce(SHBEU *beu, const struct ren_vid_surface *surface, int count);
+
+/**
+ * Maximum number of copy threads, see shbeu_set_copy_threads().
+ */
+#define SHBEU_MAX_COPY_THREADS 4
+
+/**
+ * Set how surfaces are copied to and from bounce buffers.
+ * Copies are split into chunks, which are shared between the thread doing
+ * the blend and a number of helper threads. The planes of all surfaces of a
+ * blend are copied at the same time. By default, there is one helper thread
+ * for each other CPU, up to SHBEU_MAX_COPY_THREADS, and chunks of 256KiB.
+ * \param beu BEU handle
+ * \param nr_threads Number of helper threads [0..SHBEU_MAX_COPY_THREADS],
+ * 0=copy on the calling thread only
+ * \param chunk_bytes Size of each chunk, 0=default
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_set_copy_threads(SHBEU *beu, int nr_threads, size_t chunk_bytes);
+
+/**
+ * Register a buffer the hardware can access.
+ * This is uiomux_register(), and also adds the buffer to the cache of bus
+ * addresses kept by the BEU handle. Buffers that are registered or
+ * unregistered while a BEU handle is open must use these functions rather
+ * than uiomux directly, so that the cache is kept up to date.
+ * \param beu BEU handle
+ * \param virt Virtual address of the buffer
+ * \param phys Bus address of the buffer
+ * \param size Size of the buffer in bytes
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_register(SHBEU *beu, void *virt, unsigned long phys, size_t size);
+
+/**
+ * Unregister a buffer registered with shbeu_register().
+ * \param beu BEU handle
+ * \param virt Virtual address of the buffer
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_unregister(SHBEU *beu, void *virt);
+
+/**
+ * Statistics for the bus address cache, see shbeu_get_phys_stats().
+ */
+struct shbeu_phys_stats {
+	unsigned long hits;    /**< Addresses found in the cache */
+	unsigned long misses;  /**< Addresses looked up in uiomux */
+};
+
+/**
+ * Get the statistics for the cache of bus addresses.
+ * The bus address of each plane of each surface is needed for every blend.
+ * The addresses found are cached, so that buffers used again are not looked
+ * up in uiomux.
+ * \param beu BEU handle
+ * \param stats Filled in with the statistics
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_get_phys_stats(SHBEU *beu, struct shbeu_phys_stats *stats);
+
 /** Start a surface blend
+ * If a blend is already in progress, the new blend is queued behind it.
+ * Surfaces wider or taller than the hardware allows (4092 pixels) are split
+ * into strips, which are blended one after the other. An overlay that
+ * crosses a strip boundary must be on a multiple of 4 pixels.
+ * The hardware works on multiples of 4 pixels. For surfaces of any other
+ * size, the remaining rows and columns are blended in software.
  * \param beu BEU handle
  * \param src1 Parent surface. The output will be this size.
  * \param src2 Overlay surface. Can be NULL, if no overlay required.
@@ -320,13 +495,231 @@ shbeu_start_blend(
 	const struct shbeu_surface *dest);
 
 /** Wait for a BEU operation to complete. The operation is started by a call to shbeu_start_blend.
+ * If more than one blend has been started, this waits for the oldest one.
+ * If a timeout has been set with shbeu_set_wait_policy(), a blend that does
+ * not complete in time is left queued; use shbeu_wait_timeout() to find out.
  * \param beu BEU handle
  */
 void
 shbeu_wait(SHBEU *beu);
 
+/**
+ * Resubmit blends that timed out, see shbeu_wait_timeout().
+ */
+#define SHBEU_RESUBMIT (1 << 0)
+
+/** Wait for a BEU operation to complete, with a timeout.
+ * As shbeu_wait, but if the blend does not complete in time, the BEU is
+ * reset and every queued blend is dropped, releasing the BEU for other
+ * users. The callbacks of dropped blends are still called, once each, so
+ * that callers can account for them, but their output is incomplete. With
+ * SHBEU_RESUBMIT, the dropped blends are queued again instead, and their
+ * callbacks are called when they complete. If any of them cannot be
+ * queued again, all of them are dropped. A blend that was queued behind a
+ * blend after which the BEU did not stop is treated as timed out.
+ * \param beu BEU handle
+ * \param timeout_ms Timeout in milliseconds for the whole blend, however
+ * many strips or areas it is split into, or SHBEU_WAIT_FOREVER
+ * \param flags 0 or SHBEU_RESUBMIT
+ * \retval 0 Success
+ * \retval -1 Error, the blends could not be resubmitted
+ * \retval -ETIMEDOUT The blend did not complete in time and the BEU was reset
+ */
+int
+shbeu_wait_timeout(SHBEU *beu, int timeout_ms, int flags);
+
+/** Queue a surface blend.
+ * The BEU has two register planes. While one blend is running, the next one
+ * is programmed into the other plane, so that it can be started as soon as
+ * the running blend finishes. If both planes are in use, this waits for the
+ * oldest blend to complete before queuing the new one.
+ * This saves the time taken to program the registers, but not the
+ * turnaround between blends: the hardware does not start the queued blend
+ * by itself. It is started by the CPU once it has handled the interrupt of
+ * the blend before, which happens when the caller next waits for a blend,
+ * queues one with both planes in use, or calls shbeu_try_complete(). The
+ * BEU is idle until then, for at least the interrupt latency; the time is
+ * counted in shbeu_get_wait_stats().
+ * See shbeu_start_blend for the surface parameters.
+ * The BEU is released as soon as a blend finishes. If the output has to be
+ * copied to the dest surface, the copy is done on a separate thread.
+ * \param done Called when the output of the blend is complete. Can be NULL.
+ * The callback is made from shbeu_submit, shbeu_wait or shbeu_flush, or from
+ * the copy thread if the output had to be copied. Callbacks are made in the
+ * order the blends were queued, and must not call the BEU handle.
+ * \param data Passed to the callback
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_submit(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data);
+
+/**
+ * Maximum number of windows, see shbeu_submit_windows().
+ */
+#define SHBEU_MAX_WINDOWS 4
+
+/** Queue a surface blend with additional windows.
+ * Windows are placed on the output at their (x,y) position, on top of the
+ * blended surfaces, in the same pass. They are not blended, so the alpha
+ * values are ignored. This allows tiled layouts, such as video walls, to be
+ * made in a single pass.
+ * All windows must have the same format, which must be the same colorspace
+ * as the output, and must be inside the parent surface.
+ * See shbeu_submit for the other parameters.
+ * \param windows Array of windows. Can be NULL if nr_windows is 0.
+ * \param nr_windows Number of windows [0..SHBEU_MAX_WINDOWS]
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_submit_windows(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data);
+
+/** Queue a fill of part of a surface with a solid colour.
+ * The fill is done by the BEU, and is queued with the blends. Columns and
+ * rows that are not a multiple of 4 pixels are filled by the CPU, so dest
+ * can only be a physical surface if the area is a multiple of 4 pixels.
+ * \param beu BEU handle
+ * \param dest Surface to fill
+ * \param rect Area of dest to fill, or NULL to fill the whole surface
+ * \param rgb Colour, as 0xRRGGBB. It is converted to the format of dest.
+ * See shbeu_submit for the other parameters.
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_fill(
+	SHBEU *beu,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect,
+	unsigned int rgb,
+	void (*done)(void *data),
+	void *data);
+
+/** Wait for all queued blends to complete.
+ * \param beu BEU handle
+ */
+void
+shbeu_flush(SHBEU *beu);
+
+/** Get a file descriptor that signals the completion of blends.
+ * The descriptor becomes readable when the oldest started blend has
+ * completed, so it can be added to a poll/select/epoll loop. When it is
+ * readable, call shbeu_try_complete() to finish the blend. The descriptor
+ * belongs to the BEU handle and must not be read or closed by the caller.
+ * \param beu BEU handle
+ * \retval -1 Error, otherwise the file descriptor
+ */
+int
+shbeu_get_fd(SHBEU *beu);
+
+/** Finish the oldest started blend if it has completed, without blocking.
+ * This does the same work as shbeu_wait(), except that an output copy may
+ * still be in progress on return. Use the shbeu_submit() callback to find
+ * out when the output is complete. Only useful after shbeu_get_fd().
+ * \param beu BEU handle
+ * \retval 1 A blend was finished
+ * \retval 0 No blend has completed
+ * \retval -1 Error
+ */
+int
+shbeu_try_complete(SHBEU *beu);
+
+/**
+ * Wait forever, see shbeu_set_wait_policy().
+ */
+#define SHBEU_WAIT_FOREVER -1
+
+/**
+ * Set how to wait for a blend to complete.
+ * The BEU is first polled in a tight loop, which gives the lowest latency
+ * but keeps the CPU busy. It is then polled with sleeps of increasing length
+ * in between. Finally, the interrupt is waited for. Blends that have not
+ * completed within the timeout are reported with -ETIMEDOUT by shbeu_blend
+ * and shbeu_blend_windows, and by the functions that queue blends when they
+ * have to wait for a free register plane. Timed out blends stay queued.
+ * By default there is no polling and blends are waited for forever, so
+ * the interrupt thread is only started once a timeout is set.
+ * \param beu BEU handle
+ * \param spin_count Number of times to poll in a tight loop
+ * \param backoff_us Time in microseconds to poll with sleeps in between
+ * \param timeout_ms Timeout in milliseconds, or SHBEU_WAIT_FOREVER
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_set_wait_policy(SHBEU *beu, int spin_count, int backoff_us, int timeout_ms);
+
+/**
+ * How waits for blends have ended, see shbeu_set_wait_policy().
+ */
+struct shbeu_wait_stats {
+	unsigned long spin;     /**< Blends seen complete while polling in a tight loop */
+	unsigned long backoff;  /**< Blends seen complete while polling with sleeps */
+	unsigned long sleep;    /**< Blends waited for with the interrupt */
+	unsigned long timeouts; /**< Waits that timed out */
+	unsigned long restarts; /**< Queued blends started as the one before finished */
+	unsigned long long restart_us; /**< Total microseconds the BEU was idle before those restarts */
+};
+
+/**
+ * Get the wait statistics.
+ * The time the BEU is idle before a queued blend is started is measured
+ * from when the end of the blend before it was seen: by polling, or by the
+ * interrupt thread if it is running (see shbeu_get_fd()). Otherwise the end
+ * is only seen when the caller sleeps on the interrupt, and the idle time
+ * before that is not counted.
+ * \param beu BEU handle
+ * \param stats Filled in with the statistics since the BEU was opened
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_get_wait_stats(SHBEU *beu, struct shbeu_wait_stats *stats);
+
+/**
+ * Layers dropped from blends, see shbeu_get_cull_stats().
+ */
+struct shbeu_cull_stats {
+	unsigned long invisible; /**< Overlays fully transparent or outside the parent */
+	unsigned long hidden;    /**< Layers under an opaque overlay covering the output */
+	unsigned long collapsed; /**< Blends left with a single layer, done as a copy or conversion */
+};
+
+/**
+ * Get the statistics for layers dropped from blends.
+ * Before a blend is queued, overlays that cannot be seen are dropped, so
+ * that they are not read by the hardware or copied to bounce buffers. An
+ * opaque overlay that covers the whole output hides the layers below it.
+ * \param beu BEU handle
+ * \param stats Filled in with the statistics since the BEU was opened
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_get_cull_stats(SHBEU *beu, struct shbeu_cull_stats *stats);
+
 /** Perform a surface blend.
  * See shbeu_start_blend for parameter definitions.
+ * \retval 0 Success
+ * \retval -1 Error
+ * \retval -ETIMEDOUT The blend did not complete in time
  */
 int
 shbeu_blend(
@@ -336,6 +729,281 @@ shbeu_blend(
 	const struct shbeu_surface *src3,
 	const struct shbeu_surface *dest);
 
+/** Perform a surface blend with additional windows.
+ * See shbeu_submit_windows for parameter definitions.
+ * \retval 0 Success
+ * \retval -1 Error
+ * \retval -ETIMEDOUT The blend did not complete in time
+ */
+int
+shbeu_blend_windows(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest);
+
+/**
+ * Maximum number of damage rectangles, see shbeu_submit_damage().
+ */
+#define SHBEU_MAX_DAMAGE 16
+
+/** Queue a blend of only the damaged parts of the output.
+ * The dest surface holds the output of an earlier blend of the same
+ * surfaces. Only the areas that have changed since then are blended again,
+ * the rest of dest is left as it is. Each area is clipped to src1 and
+ * rounded out to a multiple of 4 pixels, with either backend, and the
+ * areas are queued back to back. If an area cannot be queued, the areas
+ * queued before it are still blended, but done is not called. If the areas
+ * cover as much as the whole output, or an area cannot be blended on its
+ * own (an overlay that is not on a multiple of 4 pixels crosses its edge),
+ * the whole output is blended instead. Layers are culled for each area on
+ * its own, so an opaque overlay covering an area hides the layers below it
+ * there, see shbeu_get_cull_stats().
+ * dest must not be one of the sources. See shbeu_submit for the other
+ * parameters.
+ * \param rects Damaged areas, relative to src1. Can be NULL if nr_rects is 0.
+ * \param nr_rects Number of damaged areas. If more than SHBEU_MAX_DAMAGE, the
+ * whole output is blended.
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_submit_damage(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rects,
+	int nr_rects,
+	void (*done)(void *data),
+	void *data);
+
+/** Blend only the damaged parts of the output.
+ * See shbeu_submit_damage for parameter definitions.
+ * \retval 0 Success
+ * \retval -1 Error
+ * \retval -ETIMEDOUT The blend did not complete in time
+ */
+int
+shbeu_blend_damage(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rects,
+	int nr_rects);
+
+/** Compose any number of layers.
+ * The layers are blended in order, layers[0] is at the bottom and sets the
+ * size of the output. As many hardware passes as needed are used, each
+ * blending up to 3 inputs. Layers that cannot be seen, or that are hidden
+ * by an opaque layer covering the whole output, are not blended, and are
+ * counted in shbeu_get_cull_stats(). Layers that are only partly hidden
+ * are blended as usual.
+ * This function blocks until the composition is complete. If it fails,
+ * the output is incomplete.
+ * \param beu BEU handle
+ * \param layers Layers, bottom first. The same rules as for shbeu_start_blend
+ * apply to the position and size of each layer.
+ * \param nr_layers Number of layers
+ * \param dest Output surface, the same size as layers[0]
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_compose(
+	SHBEU *beu,
+	const struct shbeu_surface *layers,
+	int nr_layers,
+	const struct shbeu_surface *dest);
+
+/**
+ * A plane of a dma-buf surface, see shbeu_import_dmabuf().
+ */
+struct shbeu_dmabuf_plane {
+	int fd;         /**< dma-buf file descriptor, -1 if the plane is not used */
+	size_t offset;  /**< Offset of the plane in the dma-buf, in bytes */
+	unsigned long phys; /**< Bus address of the start of the dma-buf, from its exporter, or 0 if not known */
+};
+
+/**
+ * A surface in dma-bufs, see shbeu_import_dmabuf().
+ * The planes can be in the same dma-buf or in different ones.
+ */
+struct shbeu_dmabuf {
+	ren_vid_format_t format;     /**< Surface format */
+	int w;                       /**< Width in pixels */
+	int h;                       /**< Height in pixels */
+	int pitch;                   /**< Line pitch of every plane, in pixels */
+	struct shbeu_dmabuf_plane y; /**< Y or RGB plane */
+	struct shbeu_dmabuf_plane c; /**< CbCr plane (ignored for RGB) */
+	struct shbeu_dmabuf_plane a; /**< Alpha plane */
+};
+
+/** Make a surface from dma-buf file descriptors.
+ * The buffers are mapped and used by the hardware without being copied.
+ * Each buffer must be contiguous in the address space of the BEU, such as
+ * a buffer from a CMA heap. Its bus address is the one given by the
+ * exporter in phys, or if that is 0, the one uiomux has for the mapping.
+ * Buffers with no known bus address are rejected. The mappings are kept
+ * until the BEU handle is closed, so importing the same buffers again is
+ * cheap. The file descriptors are not kept and can be closed by the caller.
+ * The surface is opaque with alpha 255 and position (0,0), these can be
+ * changed before the surface is used.
+ * \param beu BEU handle
+ * \param buf dma-buf planes of the surface
+ * \param surface Filled in with the surface
+ * \retval 0 Success
+ * \retval -1 Error, the buffers cannot be used by the hardware
+ */
+int
+shbeu_import_dmabuf(
+	SHBEU *beu,
+	const struct shbeu_dmabuf *buf,
+	struct shbeu_surface *surface);
+
+/** Release a surface made by shbeu_import_dmabuf.
+ * The blends using the surface must be complete.
+ * \param beu BEU handle
+ * \param surface Surface from shbeu_import_dmabuf
+ */
+void
+shbeu_release_dmabuf(SHBEU *beu, struct shbeu_surface *surface);
+
+/**
+ * An opaque handle to a blend plan, see shbeu_plan_create().
+ */
+struct shbeu_plan;
+
+/**
+ * Plane addresses of a surface, see shbeu_plan_run().
+ */
+struct shbeu_addrs {
+	void *py;   /**< Address of Y or RGB plane */
+	void *pc;   /**< Address of CbCr plane (ignored for RGB) */
+	void *pa;   /**< Address of Alpha plane */
+};
+
+/** Create a plan for a blend that is repeated with different buffers.
+ * The surfaces are checked and the register values are worked out once, so
+ * that each run of the plan only has to set the buffer addresses. Typically
+ * used for video, where only the buffers change from frame to frame.
+ * The buffers given when the plan is run must have the same pitch and
+ * format as these surfaces, which are not used for anything else.
+ * The plan must be destroyed before the BEU handle is closed.
+ * See shbeu_start_blend for parameter definitions.
+ * \retval 0 Failure, otherwise the plan
+ */
+struct shbeu_plan *
+shbeu_plan_create(
+	SHBEU *beu,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest);
+
+/** Start a blend using a plan.
+ * The blend is queued in the same way as shbeu_start_blend, and is waited
+ * for with shbeu_wait or shbeu_flush. Buffers the BEU cannot access, and
+ * blends the BEU cannot do in a single operation, still work but do not
+ * benefit from the plan.
+ * \param plan Plan from shbeu_plan_create
+ * \param addrs Addresses of src1, src2, src3 and dest, in that order. The
+ * entries for surfaces that are not in the plan are ignored.
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int
+shbeu_plan_run(struct shbeu_plan *plan, const struct shbeu_addrs *addrs);
+
+/** Destroy a plan.
+ * \param plan Plan from shbeu_plan_create
+ */
+void
+shbeu_plan_destroy(struct shbeu_plan *plan);
+
+/**
+ * Maximum number of BEUs in a pool.
+ */
+#define SHBEU_POOL_MAX_UNITS 4
+
+/**
+ * An opaque handle to a pool of BEUs.
+ */
+struct shbeu_pool;
+
+/**
+ * Statistics for one BEU in a pool.
+ */
+struct shbeu_unit_stats {
+	const char *name;             /**< Name of the BEU, e.g. "BEU0" */
+	int queued;                   /**< Jobs submitted but not yet complete */
+	unsigned long jobs;           /**< Jobs completed */
+	unsigned long long busy_us;   /**< Time with at least one job queued (microseconds) */
+	unsigned int utilisation;     /**< busy_us as a percentage of the time the pool has been open */
+};
+
+/**
+ * Open all available BEUs as a pool.
+ * The BEUs named "BEU0", "BEU1", etc are opened. If there are none, the
+ * default BEU is used.
+ * \retval 0 Failure, otherwise pool handle
+ */
+struct shbeu_pool *shbeu_pool_open(void);
+
+/**
+ * Close a pool of BEUs.
+ * \param pool Pool handle
+ */
+void shbeu_pool_close(struct shbeu_pool *pool);
+
+/**
+ * Get the number of BEUs in a pool.
+ * \param pool Pool handle
+ */
+int shbeu_pool_nr_units(struct shbeu_pool *pool);
+
+/** Queue a surface blend on the least loaded BEU of a pool.
+ * An idle BEU is used if there is one, otherwise the BEU with the fewest
+ * queued jobs. See shbeu_submit for the parameters.
+ * \param pool Pool handle
+ * \retval -1 Error, otherwise the index of the BEU used
+ */
+int
+shbeu_pool_submit(
+	struct shbeu_pool *pool,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data);
+
+/** Finish all blends in a pool that have completed, without blocking.
+ * \param pool Pool handle
+ * \retval -1 Error, otherwise the number of blends finished
+ */
+int shbeu_pool_try_complete(struct shbeu_pool *pool);
+
+/** Wait for all blends in a pool to complete.
+ * \param pool Pool handle
+ */
+void shbeu_pool_flush(struct shbeu_pool *pool);
+
+/** Get the statistics for one BEU in a pool.
+ * \param pool Pool handle
+ * \param index BEU index [0..shbeu_pool_nr_units()-1]
+ * \param stats Returned statistics
+ * \retval 0 Success
+ * \retval -1 Error
+ */
+int shbeu_pool_get_stats(struct shbeu_pool *pool, int index, struct shbeu_unit_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
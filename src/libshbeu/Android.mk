@@ -7,7 +7,15 @@ LOCAL_C_INCLUDES := \
 #LOCAL_CFLAGS := -DDEBUG
 
 LOCAL_SRC_FILES := \
-	beu.c
+	beu.c \
+	bounce.c \
+	compose.c \
+	copy.c \
+	cpu_blend.c \
+	dmabuf.c \
+	owner.c \
+	phys.c \
+	pool.c
 
 LOCAL_SHARED_LIBRARIES := libcutils
 
@@ -26,13 +26,21 @@
 #endif
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/eventfd.h>
 
 #include <uiomux/uiomux.h>
 #include "shbeu/shbeu.h"
 #include "shbeu_regs.h"
+#include "shbeu_private.h"
+#include "cpu_blend.h"
 
 #include <endian.h>
 
@@ -68,6 +76,7 @@ static const struct beu_format_info beu_src_fmts[] = {
 	{ REN_BGR24,  RPKF_BGR24,     7 },
 	{ REN_RGB32,  RPKF_RGB32,     4 },
 	{ REN_ARGB32, RPKF_RGB32,     4 },
+	{ REN_PAL8,   RPKF_CLUT8,     7 },
 };
 
 static const struct beu_format_info beu_dst_fmts[] = {
@@ -79,31 +88,6 @@ static const struct beu_format_info beu_dst_fmts[] = {
 };
 
 
-struct uio_map {
-	unsigned long address;
-	unsigned long size;
-	void *iomem;
-};
-
-struct SHBEU {
-	UIOMux *uiomux;
-	uiomux_resource_t uiores;
-	struct uio_map uio_mmio;
-	struct shbeu_surface src1_hw;
-	struct shbeu_surface src2_hw;
-	struct shbeu_surface src3_hw;
-	struct shbeu_surface dest_hw;
-	struct shbeu_surface src1_user;
-	struct shbeu_surface src2_user;
-	struct shbeu_surface src3_user;
-	struct shbeu_surface dest_user;
-	struct shbeu_surface *p_src1_user;
-	struct shbeu_surface *p_src2_user;
-	struct shbeu_surface *p_src3_user;
-	struct shbeu_surface *p_dest_user;
-};
-
-
 static const struct beu_format_info *src_fmt_info(ren_vid_format_t format)
 {
 	int i, nr_fmts;
@@ -128,20 +112,28 @@ static const struct beu_format_info *dst_fmt_info(ren_vid_format_t format)
 	return NULL;
 }
 
-static void copy_plane(void *dst, void *src, int bpp, int h, int len, int dst_pitch, int src_pitch)
+/* The format a source is converted to for the hardware, see copy_source() */
+static ren_vid_format_t hw_format(ren_vid_format_t format)
 {
-	int y;
-	if (src && dst != src) {
-		for (y=0; y<h; y++) {
-			memcpy(dst, src, len * bpp);
-			src += src_pitch * bpp;
-			dst += dst_pitch * bpp;
-		}
+	switch (format) {
+	case REN_YUYV:
+	case REN_UYVY:
+		return REN_NV16;
+	case REN_NV21:
+		return REN_NV12;
+	default:
+		return format;
 	}
 }
 
-/* Copy active surface contents - assumes output is big enough */
+static void copy_plane(struct copy_batch *batch, void *dst, void *src, int bpp, int h, int len, int dst_pitch, int src_pitch)
+{
+	copy_add(batch, dst, src, len * bpp, h, dst_pitch * bpp, src_pitch * bpp);
+}
+
+/* Add a copy of the active surface contents - assumes output is big enough */
 static void copy_surface(
+	struct copy_batch *batch,
 	struct ren_vid_surface *out,
 	const struct ren_vid_surface *in)
 {
@@ -152,15 +144,229 @@ static void copy_surface(
 
 	fmt = &fmts[in->format];
 
-	copy_plane(out->py, in->py, fmt->y_bpp, in->h, in->w, out->pitch, in->pitch);
+	copy_plane(batch, out->py, in->py, fmt->y_bpp, in->h, in->w, out->pitch, in->pitch);
 
-	copy_plane(out->pc, in->pc, fmt->c_bpp,
+	copy_plane(batch, out->pc, in->pc, fmt->c_bpp,
 		in->h/fmt->c_ss_vert,
 		in->w/fmt->c_ss_horz,
 		out->pitch/fmt->c_ss_horz,
 		in->pitch/fmt->c_ss_horz);
 
-	copy_plane(out->pa, in->pa, 1, in->h, in->w, out->pitch, in->pitch);
+	copy_plane(batch, out->pa, in->pa, 1, in->h, in->w, out->pitch, in->pitch);
+}
+
+/* Repeat a tile of a plane to fill w x h pixels */
+static void fill_plane(uint8_t *dst, const uint8_t *tile, int bpp, int w, int h, int tile_w, int tile_h, int dst_pitch, int tile_pitch)
+{
+	int y, done, n;
+
+	for (y=0; y<h; y++) {
+		uint8_t *out = dst + (size_t)y * dst_pitch * bpp;
+
+		/* Each copy doubles the part of the row that is done */
+		n = (w < tile_w) ? w : tile_w;
+		memcpy(out, tile + (size_t)(y % tile_h) * tile_pitch * bpp, n * bpp);
+		for (done=n; done<w; done+=n) {
+			n = (w - done < done) ? w - done : done;
+			memcpy(out + done * bpp, out, n * bpp);
+		}
+	}
+}
+
+/* Size of a bounce buffer for plane 0 (Y/RGB), 1 (C) or 2 (alpha) */
+static size_t plane_size(const struct ren_vid_surface *s, int plane)
+{
+	int nr_pixels = s->pitch * s->h;
+
+	if (plane == 0)
+		return size_y(s->format, nr_pixels);
+	if (plane == 1)
+		return size_c(s->format, nr_pixels);
+	return size_a(s->format, nr_pixels);
+}
+
+static int is_phys(const struct shbeu_surface *spec)
+{
+	return (spec && (spec->flags & SHBEU_PHYS));
+}
+
+static int is_tile(const struct shbeu_surface *spec)
+{
+	return (spec && (spec->flags & SHBEU_TILE));
+}
+
+static int is_keyed(const struct shbeu_surface *spec)
+{
+	return (spec && (spec->flags & SHBEU_KEY));
+}
+
+/* Size of a bounce buffer for a plane of a surface. A tiled surface only
+   holds one tile. */
+static size_t hw_plane_size(const struct shbeu_surface *spec, int plane)
+{
+	struct ren_vid_surface s = spec->s;
+
+	if (is_tile(spec))
+		s.h = spec->tile_h;
+	return plane_size(&s, plane);
+}
+
+/* Add a copy of a surface that converts it to the format of the output,
+   see hw_format(). The source is only read once. */
+static void convert_surface(
+	struct copy_batch *batch,
+	struct ren_vid_surface *out,
+	const struct ren_vid_surface *in)
+{
+	switch (in->format) {
+	case REN_YUYV:
+		/* Luma is in the even bytes, CbCr in the odd ones */
+		copy_add_split(batch, out->py, out->pc, in->py, in->w * 2, in->h,
+			out->pitch, in->pitch * 2);
+		break;
+	case REN_UYVY:
+		copy_add_split(batch, out->pc, out->py, in->py, in->w * 2, in->h,
+			out->pitch, in->pitch * 2);
+		break;
+	case REN_NV21:
+		copy_plane(batch, out->py, in->py, 1, in->h, in->w, out->pitch, in->pitch);
+		copy_add_swap16(batch, out->pc, in->pc, (in->w / 2) * 2, in->h / 2,
+			out->pitch, in->pitch);
+		break;
+	default:
+		break;
+	}
+
+	copy_plane(batch, out->pa, in->pa, 1, in->h, in->w, out->pitch, in->pitch);
+}
+
+/* Add a copy of the memory of a source surface, see copy_surface() */
+static void copy_source(
+	struct copy_batch *batch,
+	struct shbeu_surface *out,
+	const struct shbeu_surface *in)
+{
+	struct ren_vid_surface out_mem = out->s;
+	struct ren_vid_surface in_mem = in->s;
+
+	if (is_tile(in)) {
+		out_mem.w = in_mem.w = in->tile_w;
+		out_mem.h = in_mem.h = in->tile_h;
+	}
+
+	if (out_mem.format != in_mem.format)
+		convert_surface(batch, &out_mem, &in_mem);
+	else
+		copy_surface(batch, &out_mem, &in_mem);
+}
+
+/* Make a copy of a tiled surface with the tile repeated in memory, for
+   when the hardware cannot repeat it. The copy is made in a bounce buffer,
+   so that the hardware reads it as it is, and must be returned with
+   bounce_put(&pvt->bounce, out->s.py, *len). */
+static int expand_tile(SHBEU *pvt, struct shbeu_surface *out,
+	const struct shbeu_surface *in, size_t *len)
+{
+	const struct format_info *fmt = &fmts[in->s.format];
+	struct ren_vid_surface *s = &out->s;
+	struct ren_vid_surface padded;
+	size_t len_y, len_c, len_a;
+	int ss_h = fmt->c_ss_horz;
+	int ss_v = fmt->c_ss_vert;
+	int w = (in->s.w + ss_h - 1) / ss_h;
+	int h = (in->s.h + ss_v - 1) / ss_v;
+
+	*out = *in;
+	out->flags &= ~SHBEU_TILE;
+	out->tile_w = 0;
+	out->tile_h = 0;
+	s->pitch = (s->w + 3) & ~3;
+
+	/* Room for the chroma of odd sizes */
+	padded = *s;
+	padded.h = (s->h + 3) & ~3;
+	len_y = plane_size(&padded, 0);
+	len_c = in->s.pc ? plane_size(&padded, 1) : 0;
+	len_a = in->s.pa ? plane_size(&padded, 2) : 0;
+
+	*len = len_y + len_c + len_a;
+	s->py = bounce_get(&pvt->bounce, *len);
+	if (!s->py)
+		return -1;
+	s->pc = in->s.pc ? (uint8_t *)s->py + len_y : NULL;
+	s->pa = in->s.pa ? (uint8_t *)s->py + len_y + len_c : NULL;
+
+	fill_plane(s->py, in->s.py, fmt->y_bpp, s->w, s->h,
+		in->tile_w, in->tile_h, s->pitch, in->s.pitch);
+	if (s->pc)
+		fill_plane(s->pc, in->s.pc, fmt->c_bpp, w, h,
+			in->tile_w / ss_h, in->tile_h / ss_v,
+			s->pitch / ss_h, in->s.pitch / ss_h);
+	if (s->pa)
+		fill_plane(s->pa, in->s.pa, 1, s->w, s->h,
+			in->tile_w, in->tile_h, s->pitch, in->s.pitch);
+
+	return 0;
+}
+
+/* Bytes of a plane from its first pixel to its last, which is the part the
+   hardware accesses */
+static size_t plane_span(const struct shbeu_surface *spec, int plane)
+{
+	const struct format_info *fmt = &fmts[spec->s.format];
+	int w = is_tile(spec) ? spec->tile_w : spec->s.w;
+	size_t tail = (spec->s.pitch > w) ? spec->s.pitch - w : 0;
+
+	/* Pixels after the last one on the last line */
+	if (plane == 0)
+		tail *= fmt->y_bpp;
+	else if (plane == 1)
+		tail = tail * fmt->c_bpp / fmt->c_ss_horz;
+
+	return hw_plane_size(spec, plane) - tail;
+}
+
+/* Bus address of plane 0 (Y/RGB), 1 (C) or 2 (alpha) of the surface, at
+   addr. 0 if the hardware cannot access all of it. */
+static unsigned long plane_phys(SHBEU *pvt, const struct shbeu_surface *spec, void *addr, int plane)
+{
+	if (is_phys(spec))
+		return (unsigned long)addr;
+	return phys_lookup(&pvt->phys, addr, plane_span(spec, plane));
+}
+
+/* Look up the planes of a surface that is blended in parts, so that the
+   parts are found in the translation cache without a lookup of their own */
+static void cache_planes(SHBEU *pvt, const struct shbeu_surface *spec)
+{
+	if (!spec || pvt->cpu)
+		return;
+
+	plane_phys(pvt, spec, spec->s.py, 0);
+	plane_phys(pvt, spec, spec->s.pc, 1);
+	plane_phys(pvt, spec, spec->s.pa, 2);
+}
+
+static void free_temp_buf(SHBEU *beu, const struct shbeu_surface *user, struct shbeu_surface *hw)
+{
+	void *user_planes[3];
+	void *hw_planes[3];
+	int i;
+
+	if (user == NULL || hw == NULL)
+		return;
+
+	user_planes[0] = user->s.py;
+	user_planes[1] = user->s.pc;
+	user_planes[2] = user->s.pa;
+	hw_planes[0] = hw->s.py;
+	hw_planes[1] = hw->s.pc;
+	hw_planes[2] = hw->s.pa;
+
+	for (i=0; i<3; i++) {
+		if (hw_planes[i] && hw_planes[i] != user_planes[i])
+			bounce_put(&beu->bounce, hw_planes[i], hw_plane_size(hw, i));
+	}
 }
 
 /* Check/create surface that can be accessed by the hardware */
@@ -171,50 +377,95 @@ static int get_hw_surface(
 {
 	struct ren_vid_surface *out = &out_spec->s;
 	const struct ren_vid_surface *in = &in_spec->s;
-	int alloc = 0;
-	size_t len;
+	void *in_planes[3];
+	void **out_planes[3];
+	int bounce[3] = { 0, 0, 0 };
+	int i, packed, convert, nr_planes = 0, nr_bounce = 0;
 
 	if (in == NULL || out == NULL)
 		return 0;
 
 	*out_spec = *in_spec;
-	if (in->py) alloc |= !uiomux_all_virt_to_phys(in->py);
-	if (in->pc) alloc |= !uiomux_all_virt_to_phys(in->pc);
-	if (in->pa) alloc |= !uiomux_all_virt_to_phys(in->pa);
-
-	if (alloc) {
-		len =  size_y(in->format, in->h * in->w);
-		if (in->pc) len += size_c(in->format, in->h * in->w);
-		if (in->pa) len += size_a(in->format, in->h * in->w);
-
-		/* One of the supplied buffers is not usable by the hardware! */
-		out->py = uiomux_malloc(beu->uiomux, beu->uiores, len, 32);
-		if (!out->py)
-			return -1;
+	convert = (hw_format(in->format) != in->format);
 
-		if (in->pc) {
-			out->pc = out->py + size_y(in->format, in->h * in->w);
+	/* The caller knows the hardware can access it */
+	if (is_phys(in_spec)) {
+		if (convert) {
+			debug_info("ERR: Physical surface needs converting");
+			return -1;
+		}
+		if (in->pitch > BEU_MAX_SIZE || (in->pitch % 4)) {
+			debug_info("ERR: Pitch invalid for a physical surface");
+			return -1;
 		}
-		if (in->pa) {
-			out->pa = out->py + size_y(in->format, in->h * in->w)
-			                  + size_c(in->format, in->h * in->w);
+		return 0;
+	}
+
+	in_planes[0] = in->py;
+	in_planes[1] = in->pc;
+	in_planes[2] = in->pa;
+	out_planes[0] = &out->py;
+	out_planes[1] = &out->pc;
+	out_planes[2] = &out->pa;
+
+	/* The hardware cannot use a pitch that is too wide or not a multiple
+	   of 4, but a packed copy of the surface is fine */
+	packed = (in->pitch > BEU_MAX_SIZE || (in->pitch % 4));
+
+	/* Only the planes the hardware cannot use are bounced, the others are
+	   used in place */
+	for (i=0; i<3; i++) {
+		if (!in_planes[i])
+			continue;
+		nr_planes++;
+		bounce[i] = packed || !plane_phys(beu, in_spec, in_planes[i], i);
+		nr_bounce += bounce[i];
+	}
+
+	/* Converted as it is copied, so every plane of the output is bounced */
+	if (convert) {
+		out->format = hw_format(in->format);
+		bounce[0] = 1;
+		bounce[1] = 1;
+		bounce[2] = (in->pa != NULL);
+		nr_bounce = nr_planes;
+	}
+
+	/* The pitch is shared by all planes, so it can only be changed if
+	   they are all bounced */
+	if (nr_bounce == nr_planes)
+		out->pitch = is_tile(in_spec) ? in_spec->tile_w : in->w;
+
+	for (i=0; i<3; i++) {
+		if (!bounce[i])
+			continue;
+
+		*out_planes[i] = bounce_get(&beu->bounce, hw_plane_size(out_spec, i));
+		if (!*out_planes[i]) {
+			*out_planes[i] = in_planes[i];
+			free_temp_buf(beu, in_spec, out_spec);
+			return -1;
 		}
 	}
 
 	return 0;
 }
 
-static void free_temp_buf(SHBEU *beu, struct ren_vid_surface *user, struct ren_vid_surface *hw)
+/* Return the temporary buffers of a job to the pool */
+static void free_temp_bufs(SHBEU *beu, struct beu_job *job)
 {
-	if (user == NULL || hw == NULL)
-		return;
-
-	if (hw->py && hw->py != user->py) {
-		size_t len = size_y(hw->format, hw->h * hw->w);
-		if (hw->pc) len += size_c(hw->format, hw->h * hw->w);
-		if (hw->pa) len += size_a(hw->format, hw->h * hw->w);
-		uiomux_free(beu->uiomux, beu->uiores, hw->py, len);
-	}
+	int i;
+
+	for (i=0; i<job->nr_windows; i++)
+		free_temp_buf(beu, &job->win_user[i], &job->win_hw[i]);
+	if (job->p_dest_user)
+		free_temp_buf(beu, job->p_dest_user, &job->dest_hw);
+	if (job->p_src3_user)
+		free_temp_buf(beu, job->p_src3_user, &job->src3_hw);
+	if (job->p_src2_user)
+		free_temp_buf(beu, job->p_src2_user, &job->src2_hw);
+	if (job->p_src1_user)
+		free_temp_buf(beu, job->p_src1_user, &job->src1_hw);
 }
 
 
@@ -243,465 +494,2894 @@ static void write_reg(void *base_addr, uint32_t value, int reg_nr)
 	*reg = value;
 }
 
-SHBEU *shbeu_open_named(const char *name)
+/* Helper functions for building register values in memory. */
+
+static uint32_t get_reg(const struct beu_regs *regs, int reg_nr)
 {
-	SHBEU *beu;
-	int ret;
+	return regs->val[reg_nr / 4];
+}
 
-	beu = calloc(1, sizeof(*beu));
-	if (!beu)
-		goto err;
+static void set_reg(struct beu_regs *regs, uint32_t value, int reg_nr)
+{
+	regs->val[reg_nr / 4] = value;
+	regs->set[reg_nr / 128] |= 1U << ((reg_nr / 4) % 32);
+}
 
-	if (!name) {
-		beu->uiomux = uiomux_open();
-		beu->uiores = UIOMUX_SH_BEU;
-	} else {
-		const char *blocks[2] = { name, NULL };
-		beu->uiomux = uiomux_open_named(blocks);
-		beu->uiores = (1 << 0);
-	}
-	if (!beu->uiomux)
-		goto err;
+/* Write a register, unless the hardware is known to hold the value */
+static void write_reg_shadow(void *base_addr, struct beu_shadow *shadow, uint32_t value, int reg_nr)
+{
+	struct beu_regs *regs = &shadow->regs;
+	uint32_t bit = 1U << ((reg_nr / 4) % 32);
 
-	ret = uiomux_get_mmio (beu->uiomux, beu->uiores,
-		&beu->uio_mmio.address,
-		&beu->uio_mmio.size,
-		&beu->uio_mmio.iomem);
-	if (!ret)
-		goto err;
+	if (shadow->valid && (regs->set[reg_nr / 128] & bit) && regs->val[reg_nr / 4] == value)
+		return;
 
-#ifdef DEBUG
-	fprintf(stderr, "BEU registers start at 0x%lX (virt: %p)\n", beu->uio_mmio.address, beu->uio_mmio.iomem);
-#endif
+	write_reg(base_addr, value, reg_nr);
+	set_reg(regs, value, reg_nr);
+}
 
-	return beu;
+/* Write the registers that have changed since the last time */
+static void commit_regs(void *base_addr, struct beu_shadow *shadow, const struct beu_regs *regs)
+{
+	int i, reg_nr;
 
-err:
-	debug_info("ERR: error detected");
-	shbeu_close(beu);
-	return 0;
+	for (i=0; i<(BEU_NR_REGS + 31) / 32; i++) {
+		uint32_t set = regs->set[i];
+
+		while (set) {
+			reg_nr = (i * 32 + __builtin_ctz(set)) * 4;
+			set &= set - 1;
+			write_reg_shadow(base_addr, shadow, regs->val[reg_nr / 4], reg_nr);
+		}
+	}
+	shadow->valid = 1;
 }
 
-SHBEU *shbeu_open(void)
+/* The hardware registers no longer match the shadows */
+static void invalidate_shadows(SHBEU *pvt)
 {
-	return shbeu_open_named(NULL);
+	pvt->shadow[0].valid = 0;
+	pvt->shadow[1].valid = 0;
+	pvt->ctrl.valid = 0;
 }
 
-void shbeu_close(SHBEU *pvt)
+static unsigned long long now_us(void)
 {
-	if (pvt) {
-		if (pvt->uiomux)
-			uiomux_close(pvt->uiomux);
-		free(pvt);
-	}
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
-/* Setup input surface */
-static int
-setup_src_surface(void *base_addr, int index, const struct shbeu_surface *spec)
+/* The interrupt thread sleeps on the BEU for each started job and signals
+   the event fd when the job completes */
+static void *irq_thread(void *arg)
 {
-	const int offsets[] = {SRC1_BASE, SRC2_BASE, SRC3_BASE};
-	int offset = offsets[index];
-	uint32_t tmp;
-	const struct beu_format_info *info;
-	const struct ren_vid_surface *surface = &spec->s;
-	uint32_t Y, C, A;
+	SHBEU *pvt = arg;
+	uint64_t one = 1;
 
-	/* Not having an overlay surface is valid */
-	if (!surface)
-		return 0;
+	/* The thread can only be cancelled while waiting for an interrupt that
+	   may never come, see end_irq_thread() */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-	info = src_fmt_info(surface->format);
-	if (!info) {
-		debug_info("ERR: Invalid surface format!");
-		return -1;
-	}
+	pthread_mutex_lock(&pvt->irq_mutex);
+	while (1) {
+		while (!pvt->irq_armed && !pvt->irq_quit)
+			pthread_cond_wait(&pvt->irq_cond, &pvt->irq_mutex);
+		if (pvt->irq_quit)
+			break;
+		pvt->irq_armed--;
+		pthread_mutex_unlock(&pvt->irq_mutex);
 
-	Y = uiomux_all_virt_to_phys(surface->py);
-	C = uiomux_all_virt_to_phys(surface->pc);
-	A = uiomux_all_virt_to_phys(surface->pa);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		uiomux_sleep(pvt->uiomux, pvt->uiores);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
-#ifdef DEBUG
-	fprintf(stderr, "\nsrc%d: fmt=%d: width=%d, height=%d pitch=%d\n",
-		index+1, surface->format, surface->w, surface->h, surface->pitch);
-	fprintf(stderr, "\tY/RGB (0x%X), C (0x%X), alpha (0x%X)\n", Y, C, A);
-	fprintf(stderr, "\toffset=(%d,%d), alternative alpha =%u\n", spec->x, spec->y, spec->alpha);
-#endif
+		/* Read by the caller once it has consumed the event */
+		pvt->irq_us = now_us();
 
-	if (!Y) {
-		debug_info("ERR: Could not get phys address from uiomux!");
-		return -1;
-	}
+		while (write(pvt->event_fd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
 
-	if ((surface->w % 4) || (surface->pitch % 4) || (surface->h % 4)) {
-		debug_info("ERR: Width/height invalid!");
-		return -1;
+		pthread_mutex_lock(&pvt->irq_mutex);
 	}
+	pthread_mutex_unlock(&pvt->irq_mutex);
 
-	if ((surface->w > 4092) || (surface->pitch > 4092) || (surface->h > 4092)) {
-		debug_info("ERR: Width/height too big!");
-		return -1;
-	}
+	return NULL;
+}
 
-	if (is_rgb(surface->format) && surface->pa) {
-		debug_info("ERR: RGB with alpha not supported!");
+static int run_irq_thread(SHBEU *pvt)
+{
+	pthread_mutex_init(&pvt->irq_mutex, NULL);
+	pthread_cond_init(&pvt->irq_cond, NULL);
+
+	/* The running job, if any, has not been waited for */
+	pvt->irq_armed = (pvt->nr_jobs > 0);
+	pvt->irq_quit = 0;
+
+	if (pthread_create(&pvt->irq_thread, NULL, irq_thread, pvt) != 0) {
+		pthread_cond_destroy(&pvt->irq_cond);
+		pthread_mutex_destroy(&pvt->irq_mutex);
 		return -1;
 	}
 
-	/* Surface pitch */
-	tmp = size_y(surface->format, surface->pitch);
-	write_reg(base_addr, tmp, BSMWR + offset);
+	return 0;
+}
 
-	write_reg(base_addr, (surface->h << 16) | surface->w, BSSZR + offset);
-	write_reg(base_addr, Y, BSAYR + offset);
-	write_reg(base_addr, C, BSACR + offset);
-	write_reg(base_addr, A, BSAAR + offset);
+static void end_irq_thread(SHBEU *pvt)
+{
+	pthread_mutex_lock(&pvt->irq_mutex);
+	pvt->irq_quit = 1;
+	pthread_cond_signal(&pvt->irq_cond);
+	pthread_mutex_unlock(&pvt->irq_mutex);
 
-	/* Surface format */
-	tmp = info->bpXfr;
-	if (is_ycbcr(surface->format) && surface->pa)
-		tmp += CHRR_YCBCR_ALPHA;
-	write_reg(base_addr, tmp, BSIFR + offset);
+	/* In case it is waiting for an interrupt that was lost */
+	pthread_cancel(pvt->irq_thread);
 
-	/* Position of overlay */
-	tmp = (spec->y << 16) | spec->x;
-	write_reg(base_addr, tmp, BLOCR1 + index*4);
+	pthread_join(pvt->irq_thread, NULL);
+	pthread_cond_destroy(&pvt->irq_cond);
+	pthread_mutex_destroy(&pvt->irq_mutex);
+}
 
-#ifdef __LITTLE_ENDIAN__
-	/* byte/word swapping */
-	tmp = read_reg(base_addr, BSWPR);
-	tmp |= BSWPR_MODSEL;
-	tmp |= (info->bswpr << index*8);
-	write_reg(base_addr, tmp, BSWPR);
-#endif
+static int start_irq_thread(SHBEU *pvt)
+{
+	pvt->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+	if (pvt->event_fd < 0)
+		return -1;
 
-	/* Set alpha value for entire plane, if no alpha data */
-	tmp = read_reg(base_addr, BBLCR0);
-	if (surface->pa || surface->format == REN_ARGB32)
-		tmp |= (1 << (index+28));
-	else
-		tmp |= ((spec->alpha & 0xFF) << index*8);
-	write_reg(base_addr, tmp, BBLCR0);
+	/* Software blends never signal completion */
+	if (pvt->cpu)
+		return 0;
+
+	if (run_irq_thread(pvt) < 0) {
+		close(pvt->event_fd);
+		pvt->event_fd = -1;
+		return -1;
+	}
 
 	return 0;
 }
 
-/* Setup output surface */
-/* The dest size is defined by input surface 1. The output can be on a larger
-   canvas by setting the pitch */
-static int
-setup_dst_surface(void *base_addr, const struct shbeu_surface *spec)
+static void stop_irq_thread(SHBEU *pvt)
 {
-	uint32_t tmp;
-	const struct beu_format_info *info;
-	const struct ren_vid_surface *dest = &spec->s;
-	uint32_t Y, C;
-
-	if (!dest)
-		return -1;
+	if (pvt->event_fd < 0)
+		return;
 
-	info = dst_fmt_info(dest->format);
-	if (!info) {
-		debug_info("ERR: Invalid surface format!");
-		return -1;
-	}
+	if (!pvt->cpu)
+		end_irq_thread(pvt);
 
-	Y = uiomux_all_virt_to_phys(dest->py);
-	C = uiomux_all_virt_to_phys(dest->pc);
+	close(pvt->event_fd);
+	pvt->event_fd = -1;
+}
 
-#ifdef DEBUG
-	fprintf(stderr, "\ndest: fmt=%d: pitch=%d\n", dest->format, dest->pitch);
-	fprintf(stderr, "\tY/RGB (0x%X), C (0x%X)\n", Y, C);
-#endif
+static void run_fixups(const struct beu_fixup *f)
+{
+	int i;
 
-	if (!Y) {
-		debug_info("ERR: Could not get phys address from uiomux!");
-		return -1;
+	for (i=0; i<f->nr_rects; i++) {
+		if (f->fill) {
+			cpu_fill(&f->dest, &f->rects[i], f->rgb);
+			continue;
+		}
+		cpu_blend(&f->src[0],
+			(f->nr_srcs > 1) ? &f->src[1] : NULL,
+			(f->nr_srcs > 2) ? &f->src[2] : NULL,
+			f->win, f->nr_windows, &f->dest, &f->rects[i]);
 	}
+}
 
-	if ((dest->pitch % 4) || (dest->pitch > 4092)) {
-		debug_info("ERR: pitch invalid!");
-		return -1;
+/* Hand the output of a finished job to the user. The hardware is not used. */
+static void finish_output(SHBEU *pvt, struct beu_job *job)
+{
+	/* If we had to allocate hardware output buffer, copy the contents */
+	if (job->p_dest_user) {
+		struct copy_batch batch;
+
+		copy_batch_init(&batch);
+		copy_surface(&batch, &job->p_dest_user->s, &job->dest_hw.s);
+		copy_run(&pvt->copy, &batch);
 	}
 
-	/* Surface pitch */
-	tmp = size_y(dest->format, dest->pitch);
-	write_reg(base_addr, tmp, BDMWR);
+	/* Free any temporary hardware buffers */
+	free_temp_bufs(pvt, job);
 
-	write_reg(base_addr, Y, BDAYR);
-	write_reg(base_addr, C, BDACR);
-	write_reg(base_addr, 0, BAFXR);
+	/* Parts of the output the hardware could not do */
+	if (job->fixup.nr_rects)
+		run_fixups(&job->fixup);
 
-	/* Surface format */
-	write_reg(base_addr, info->bpXfr, BPKFR);
+	if (job->owned)
+		bounce_put(&pvt->bounce, job->owned, job->owned_len);
 
-#ifdef __LITTLE_ENDIAN__
-	/* byte/word swapping */
-	tmp = read_reg(base_addr, BSWPR);
-	tmp |= info->bswpr << 4;
-	write_reg(base_addr, tmp, BSWPR);
-#endif
+	if (job->done)
+		job->done(job->done_data);
+}
 
-	return 0;
+/* Does the output of a job need more than a callback? */
+static int needs_cpu(const struct beu_job *job)
+{
+	if (job->fixup.nr_rects)
+		return 1;
+
+	if (!job->p_dest_user)
+		return 0;
+
+	return (job->p_dest_user->s.py != job->dest_hw.s.py ||
+		job->p_dest_user->s.pc != job->dest_hw.s.pc);
 }
 
+/* The copy thread finishes the output of jobs in the order they are queued */
+static void *copy_thread(void *arg)
+{
+	SHBEU *pvt = arg;
+
+	pthread_mutex_lock(&pvt->copy_mutex);
+	while (1) {
+		while (!pvt->nr_tasks && !pvt->copy_quit)
+			pthread_cond_wait(&pvt->copy_cond, &pvt->copy_mutex);
+		if (!pvt->nr_tasks)
+			break;
+		pthread_mutex_unlock(&pvt->copy_mutex);
+
+		/* The task is not reused until it is removed from the queue */
+		finish_output(pvt, &pvt->tasks[pvt->task_head]);
+
+		pthread_mutex_lock(&pvt->copy_mutex);
+		pvt->task_head = (pvt->task_head + 1) % BEU_NR_TASKS;
+		pvt->nr_tasks--;
+		pthread_cond_broadcast(&pvt->copied_cond);
+	}
+	pthread_mutex_unlock(&pvt->copy_mutex);
+
+	return NULL;
+}
+
+static int start_copy_thread(SHBEU *pvt)
+{
+	pthread_mutex_init(&pvt->copy_mutex, NULL);
+	pthread_cond_init(&pvt->copy_cond, NULL);
+	pthread_cond_init(&pvt->copied_cond, NULL);
+	pvt->task_head = 0;
+	pvt->nr_tasks = 0;
+	pvt->copy_quit = 0;
+
+	if (pthread_create(&pvt->copy_thread, NULL, copy_thread, pvt) != 0) {
+		pthread_cond_destroy(&pvt->copied_cond);
+		pthread_cond_destroy(&pvt->copy_cond);
+		pthread_mutex_destroy(&pvt->copy_mutex);
+		return -1;
+	}
+
+	pvt->copy_started = 1;
+	return 0;
+}
+
+/* Queued tasks are finished before the thread ends */
+static void stop_copy_thread(SHBEU *pvt)
+{
+	if (!pvt->copy_started)
+		return;
+
+	pthread_mutex_lock(&pvt->copy_mutex);
+	pvt->copy_quit = 1;
+	pthread_cond_signal(&pvt->copy_cond);
+	pthread_mutex_unlock(&pvt->copy_mutex);
+
+	pthread_join(pvt->copy_thread, NULL);
+	pthread_cond_destroy(&pvt->copied_cond);
+	pthread_cond_destroy(&pvt->copy_cond);
+	pthread_mutex_destroy(&pvt->copy_mutex);
+	pvt->copy_started = 0;
+}
+
+/* Wait for the output of all finished jobs */
+static void wait_tasks(SHBEU *pvt)
+{
+	if (!pvt->copy_started)
+		return;
+
+	pthread_mutex_lock(&pvt->copy_mutex);
+	while (pvt->nr_tasks)
+		pthread_cond_wait(&pvt->copied_cond, &pvt->copy_mutex);
+	pthread_mutex_unlock(&pvt->copy_mutex);
+}
+
+/* Finish the output of a job that has left the hardware. Copies are done on
+   the copy thread, so that the next job is not held up by them. Callbacks
+   are made in the order the jobs finish. */
+static void queue_output(SHBEU *pvt, struct beu_job *job)
+{
+	struct beu_job *task;
+
+	if (!pvt->copy_started) {
+		if (!needs_cpu(job) || start_copy_thread(pvt) < 0) {
+			finish_output(pvt, job);
+			return;
+		}
+	}
+
+	pthread_mutex_lock(&pvt->copy_mutex);
+
+	if (!pvt->nr_tasks && !needs_cpu(job)) {
+		pthread_mutex_unlock(&pvt->copy_mutex);
+		finish_output(pvt, job);
+		return;
+	}
+
+	while (pvt->nr_tasks == BEU_NR_TASKS)
+		pthread_cond_wait(&pvt->copied_cond, &pvt->copy_mutex);
+
+	/* The job may be reused as soon as it has been copied */
+	task = &pvt->tasks[(pvt->task_head + pvt->nr_tasks) % BEU_NR_TASKS];
+	*task = *job;
+	task->p_src1_user = job->p_src1_user ? &task->src1_user : NULL;
+	task->p_src2_user = job->p_src2_user ? &task->src2_user : NULL;
+	task->p_src3_user = job->p_src3_user ? &task->src3_user : NULL;
+	task->p_dest_user = job->p_dest_user ? &task->dest_user : NULL;
+
+	pvt->nr_tasks++;
+	pthread_cond_signal(&pvt->copy_cond);
+	pthread_mutex_unlock(&pvt->copy_mutex);
+}
+
+SHBEU *shbeu_open_named(const char *name)
+{
+	SHBEU *beu;
+	int ret;
+
+	beu = calloc(1, sizeof(*beu));
+	if (!beu)
+		goto err;
+
+	beu->event_fd = -1;
+	beu->timeout_ms = SHBEU_WAIT_FOREVER;
+
+	/* Software blends are also used for the parts the hardware cannot do */
+	cpu_blend_init();
+
+	if (name && !strcmp(name, SHBEU_CPU)) {
+		beu->cpu = 1;
+		return beu;
+	}
+
+	if (!name) {
+		beu->uiomux = uiomux_open();
+		beu->uiores = UIOMUX_SH_BEU;
+	} else {
+		const char *blocks[2] = { name, NULL };
+		beu->uiomux = uiomux_open_named(blocks);
+		beu->uiores = (1 << 0);
+	}
+	if (!beu->uiomux)
+		goto err;
+
+	ret = uiomux_get_mmio (beu->uiomux, beu->uiores,
+		&beu->uio_mmio.address,
+		&beu->uio_mmio.size,
+		&beu->uio_mmio.iomem);
+	if (!ret)
+		goto err;
+
+	bounce_init(&beu->bounce, beu->uiomux, beu->uiores);
+	phys_init(&beu->phys);
+	copy_init(&beu->copy);
+	owner_init(&beu->owner);
+
+#ifdef DEBUG
+	fprintf(stderr, "BEU registers start at 0x%lX (virt: %p)\n", beu->uio_mmio.address, beu->uio_mmio.iomem);
+#endif
+
+	return beu;
+
+err:
+	debug_info("ERR: error detected");
+	shbeu_close(beu);
+	return 0;
+}
+
+SHBEU *shbeu_open(void)
+{
+	return shbeu_open_named(NULL);
+}
+
+int shbeu_set_bounce_limits(SHBEU *pvt, int max_per_size, size_t max_bytes)
+{
+	if (!pvt)
+		return -1;
+	if (pvt->cpu)
+		return 0;
+
+	return bounce_set_limits(&pvt->bounce, max_per_size, max_bytes);
+}
+
+int shbeu_set_copy_threads(SHBEU *pvt, int nr_threads, size_t chunk_bytes)
+{
+	if (!pvt)
+		return -1;
+	if (pvt->cpu)
+		return 0;
+
+	return copy_set_threads(&pvt->copy, nr_threads, chunk_bytes);
+}
+
+int shbeu_register(SHBEU *pvt, void *virt, unsigned long phys, size_t size)
+{
+	if (!pvt || !virt || !size)
+		return -1;
+
+	if (uiomux_register(virt, phys, size) < 0)
+		return -1;
+
+	/* The address may have been cached for an older registration */
+	phys_invalidate(&pvt->phys);
+	phys_add(&pvt->phys, virt, phys, size);
+
+	return 0;
+}
+
+int shbeu_unregister(SHBEU *pvt, void *virt)
+{
+	if (!pvt || !virt)
+		return -1;
+
+	phys_invalidate(&pvt->phys);
+	uiomux_unregister(virt);
+
+	return 0;
+}
+
+int shbeu_get_phys_stats(SHBEU *pvt, struct shbeu_phys_stats *stats)
+{
+	if (!pvt || !stats)
+		return -1;
+
+	stats->hits = pvt->phys.hits;
+	stats->misses = pvt->phys.misses;
+	return 0;
+}
+
+int shbeu_prealloc_bounce(SHBEU *pvt, const struct ren_vid_surface *surface, int count)
+{
+	struct ren_vid_surface packed;
+	void *planes[3];
+	size_t lens[3];
+	int i, nr_lens = 0;
+
+	if (!pvt || !surface)
+		return -1;
+	if (pvt->cpu)
+		return 0;
+
+	/* Surfaces with every plane bounced are packed, see get_hw_surface() */
+	packed = *surface;
+	packed.format = hw_format(surface->format);
+	packed.pitch = packed.w;
+	planes[0] = surface->py;
+	planes[1] = surface->pc;
+	planes[2] = surface->pa;
+
+	/* Converted surfaces always get a chroma plane */
+	if (packed.format != surface->format)
+		planes[1] = surface->py;
+
+	/* Enough for every plane to be bounced */
+	for (i=0; i<3; i++) {
+		if (i > 0 && !planes[i])
+			continue;
+		lens[nr_lens++] = plane_size(&packed, i);
+	}
+
+	return bounce_prealloc(&pvt->bounce, lens, nr_lens, count);
+}
+
+void shbeu_close(SHBEU *pvt)
+{
+	if (pvt) {
+		/* Blends that do not complete are dropped */
+		while (pvt->nr_jobs)
+			shbeu_wait_timeout(pvt, pvt->timeout_ms, 0);
+		stop_copy_thread(pvt);
+		stop_irq_thread(pvt);
+		dmabuf_exit(pvt);
+		owner_exit(&pvt->owner);
+		if (pvt->bounce.uiomux) {
+			copy_exit(&pvt->copy);
+			bounce_exit(&pvt->bounce);
+		}
+		if (pvt->fill_tile)
+			uiomux_free(pvt->uiomux, pvt->uiores, pvt->fill_tile, FILL_TILE_SIZE);
+		if (pvt->uiomux)
+			uiomux_close(pvt->uiomux);
+		free(pvt);
+	}
+}
+
+/* Setup input surface */
+static int
+setup_src_surface(SHBEU *pvt, struct beu_regs *regs, int index, const struct shbeu_surface *spec)
+{
+	const int offsets[] = {SRC1_BASE, SRC2_BASE, SRC3_BASE};
+	int offset = offsets[index];
+	uint32_t tmp;
+	const struct beu_format_info *info;
+	const struct ren_vid_surface *surface = &spec->s;
+	uint32_t Y, C, A;
+
+	/* Not having an overlay surface is valid */
+	if (!surface)
+		return 0;
+
+	info = src_fmt_info(surface->format);
+	if (!info) {
+		debug_info("ERR: Invalid surface format!");
+		return -1;
+	}
+
+	Y = plane_phys(pvt, spec, surface->py, 0);
+	C = plane_phys(pvt, spec, surface->pc, 1);
+	A = plane_phys(pvt, spec, surface->pa, 2);
+
+#ifdef DEBUG
+	fprintf(stderr, "\nsrc%d: fmt=%d: width=%d, height=%d pitch=%d\n",
+		index+1, surface->format, surface->w, surface->h, surface->pitch);
+	fprintf(stderr, "\tY/RGB (0x%X), C (0x%X), alpha (0x%X)\n", Y, C, A);
+	fprintf(stderr, "\toffset=(%d,%d), alternative alpha =%u\n", spec->x, spec->y, spec->alpha);
+#endif
+
+	if (!Y) {
+		debug_info("ERR: Could not get phys address from uiomux!");
+		return -1;
+	}
+
+	if ((surface->w % 4) || (surface->pitch % 4) || (surface->h % 4)) {
+		debug_info("ERR: Width/height invalid!");
+		return -1;
+	}
+
+	if ((surface->w > BEU_MAX_SIZE) || (surface->pitch > BEU_MAX_SIZE) || (surface->h > BEU_MAX_SIZE)) {
+		debug_info("ERR: Width/height too big!");
+		return -1;
+	}
+
+	if (is_rgb(surface->format) && surface->pa) {
+		debug_info("ERR: RGB with alpha not supported!");
+		return -1;
+	}
+
+	/* Only input 1 can repeat a tile */
+	if (is_tile(spec)) {
+		if (index != 0) {
+			debug_info("ERR: Tiled surface is not on input 1");
+			return -1;
+		}
+		set_reg(regs, (spec->tile_h << 16) | spec->tile_w, BTPSR);
+	}
+
+	/* Transparent colour. Every colour that the format stores as the key
+	   is in the range. */
+	if (is_keyed(spec)) {
+		uint32_t mask = key_mask(surface->format);
+		uint32_t key = spec->key & mask;
+
+		if (!is_rgb(surface->format)) {
+			debug_info("ERR: Colour key needs an RGB surface!");
+			return -1;
+		}
+		set_reg(regs, key, BPCCR11 + index*8);
+		set_reg(regs, key | (~mask & 0xFFFFFF), BPCCR12 + index*8);
+		set_reg(regs, get_reg(regs, BPCCR0) | BPCCR0_TCE(index), BPCCR0);
+	}
+
+	/* Surface pitch */
+	tmp = size_y(surface->format, surface->pitch);
+	set_reg(regs, tmp, BSMWR + offset);
+
+	set_reg(regs, (surface->h << 16) | surface->w, BSSZR + offset);
+	set_reg(regs, Y, BSAYR + offset);
+	set_reg(regs, C, BSACR + offset);
+	set_reg(regs, A, BSAAR + offset);
+
+	/* Surface format */
+	tmp = info->bpXfr;
+	if (is_ycbcr(surface->format) && surface->pa)
+		tmp += CHRR_YCBCR_ALPHA;
+	set_reg(regs, tmp, BSIFR + offset);
+
+	/* Position of overlay */
+	tmp = (spec->y << 16) | spec->x;
+	set_reg(regs, tmp, BLOCR1 + index*4);
+
+#ifdef __LITTLE_ENDIAN__
+	/* byte/word swapping */
+	tmp = get_reg(regs, BSWPR);
+	tmp |= BSWPR_MODSEL;
+	tmp |= (info->bswpr << index*8);
+	set_reg(regs, tmp, BSWPR);
+#endif
+
+	/* Set alpha value for entire plane, if no alpha data */
+	tmp = get_reg(regs, BBLCR0);
+	if (surface->pa || surface->format == REN_ARGB32 || surface->format == REN_PAL8)
+		tmp |= (1 << (index+28));
+	else
+		tmp |= ((spec->alpha & 0xFF) << index*8);
+	set_reg(regs, tmp, BBLCR0);
+
+	return 0;
+}
+
+/* Setup output surface */
+/* The dest size is defined by input surface 1. The output can be on a larger
+   canvas by setting the pitch */
+static int
+setup_dst_surface(SHBEU *pvt, struct beu_regs *regs, const struct shbeu_surface *spec)
+{
+	uint32_t tmp;
+	const struct beu_format_info *info;
+	const struct ren_vid_surface *dest = &spec->s;
+	uint32_t Y, C;
+
+	if (!dest)
+		return -1;
+
+	info = dst_fmt_info(dest->format);
+	if (!info) {
+		debug_info("ERR: Invalid surface format!");
+		return -1;
+	}
+
+	Y = plane_phys(pvt, spec, dest->py, 0);
+	C = plane_phys(pvt, spec, dest->pc, 1);
+
+#ifdef DEBUG
+	fprintf(stderr, "\ndest: fmt=%d: pitch=%d\n", dest->format, dest->pitch);
+	fprintf(stderr, "\tY/RGB (0x%X), C (0x%X)\n", Y, C);
+#endif
+
+	if (!Y) {
+		debug_info("ERR: Could not get phys address from uiomux!");
+		return -1;
+	}
+
+	if ((dest->pitch % 4) || (dest->pitch > BEU_MAX_SIZE)) {
+		debug_info("ERR: pitch invalid!");
+		return -1;
+	}
+
+	/* Surface pitch */
+	tmp = size_y(dest->format, dest->pitch);
+	set_reg(regs, tmp, BDMWR);
+
+	set_reg(regs, Y, BDAYR);
+	set_reg(regs, C, BDACR);
+	set_reg(regs, 0, BAFXR);
+
+	/* Surface format */
+	set_reg(regs, info->bpXfr, BPKFR);
+
+#ifdef __LITTLE_ENDIAN__
+	/* byte/word swapping */
+	tmp = get_reg(regs, BSWPR);
+	tmp |= info->bswpr << 4;
+	set_reg(regs, tmp, BSWPR);
+#endif
+
+	return 0;
+}
+
+/* Setup a multi-window input. These are not blended, but placed on top of
+   the output */
+static int
+setup_window(SHBEU *pvt, struct beu_regs *regs, int index, const struct shbeu_surface *spec)
+{
+	const int offsets[] = {MD_SRC1_BASE, MD_SRC2_BASE, MD_SRC3_BASE, MD_SRC4_BASE};
+	const int locations[] = {BMLOCR1, BMLOCR2, BMLOCR3, BMLOCR4};
+	int offset = offsets[index];
+	uint32_t tmp;
+	const struct beu_format_info *info;
+	const struct ren_vid_surface *surface = &spec->s;
+	uint32_t Y, C;
+
+	info = src_fmt_info(surface->format);
+	if (!info) {
+		debug_info("ERR: Invalid surface format!");
+		return -1;
+	}
+
+	Y = plane_phys(pvt, spec, surface->py, 0);
+	C = plane_phys(pvt, spec, surface->pc, 1);
+
+#ifdef DEBUG
+	fprintf(stderr, "\nwindow%d: fmt=%d: width=%d, height=%d pitch=%d\n",
+		index+1, surface->format, surface->w, surface->h, surface->pitch);
+	fprintf(stderr, "\tY/RGB (0x%X), C (0x%X)\n", Y, C);
+	fprintf(stderr, "\toffset=(%d,%d)\n", spec->x, spec->y);
+#endif
+
+	if (!Y) {
+		debug_info("ERR: Could not get phys address from uiomux!");
+		return -1;
+	}
+
+	if ((surface->w % 4) || (surface->pitch % 4) || (surface->h % 4)) {
+		debug_info("ERR: Width/height invalid!");
+		return -1;
+	}
+
+	if ((surface->w > BEU_MAX_SIZE) || (surface->pitch > BEU_MAX_SIZE) || (surface->h > BEU_MAX_SIZE)) {
+		debug_info("ERR: Width/height too big!");
+		return -1;
+	}
+
+	/* Surface pitch */
+	tmp = size_y(surface->format, surface->pitch);
+	set_reg(regs, tmp, BMSMWR + offset);
+
+	set_reg(regs, (surface->h << 16) | surface->w, BMSSZR + offset);
+	set_reg(regs, Y, BMSAYR + offset);
+	set_reg(regs, C, BMSACR + offset);
+
+	/* Position of window */
+	tmp = (spec->y << 16) | spec->x;
+	set_reg(regs, tmp, locations[index]);
+
+	/* All windows share the format register */
+	if (index == 0) {
+		set_reg(regs, info->bpXfr, BMSIFR);
+
+#ifdef __LITTLE_ENDIAN__
+		/* byte/word swapping */
+		tmp = get_reg(regs, BSWPR);
+		tmp |= BSWPR_MODSEL;
+		tmp |= (info->bswpr << 24);
+		set_reg(regs, tmp, BSWPR);
+#endif
+	}
+
+	return 0;
+}
+
+/* Check the windows can be placed on the output in a single pass */
+static int
+check_windows(
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest)
+{
+	int i;
+
+	if (nr_windows < 0 || nr_windows > SHBEU_MAX_WINDOWS || (nr_windows && !windows)) {
+		debug_info("ERR: Invalid number of windows");
+		return -1;
+	}
+
+	for (i=0; i<nr_windows; i++) {
+		const struct shbeu_surface *win = &windows[i];
+
+		if (is_tile(win) || is_keyed(win) || win->s.format == REN_PAL8) {
+			debug_info("ERR: Windows cannot be tiled, keyed or use a palette");
+			return -1;
+		}
+
+		/* There is only one format register for all windows */
+		if (win->s.format != windows[0].s.format) {
+			debug_info("ERR: All windows must have the same format");
+			return -1;
+		}
+
+		/* Windows are not colorspace converted */
+		if (different_colorspace(win->s.format, dest->s.format)) {
+			debug_info("ERR: Window colorspace differs from the output");
+			return -1;
+		}
+
+		if (win->x < 0 || win->y < 0 ||
+		    win->x + win->s.w > src1->s.w || win->y + win->s.h > src1->s.h) {
+			debug_info("ERR: Window is outside the parent surface");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Program the registers of one plane for a blend */
+static int
+program_blend(
+	SHBEU *pvt,
+	struct beu_regs *regs,
+	struct shbeu_surface *src1,
+	struct shbeu_surface *src2,
+	struct shbeu_surface *src3,
+	struct shbeu_surface *dest,
+	struct shbeu_surface *windows,
+	int nr_windows,
+	uint32_t *start_reg,
+	const struct shbeu_surface **inputs)
+{
+	uint32_t bmwcr0 = 0;
+	int i;
+	const struct shbeu_surface *src_check = src1;
+	uint32_t bblcr1 = 0;
+	uint32_t bblcr0 = 0;
+
+	/* Ensure src2 and src3 formats are the same type (only input 1 on the
+	   hardware has colorspace conversion */
+	if (src2 && src3) {
+		if (different_colorspace(src2->s.format, src3->s.format)) {
+			if (different_colorspace(src1->s.format, src2->s.format)) {
+				/* src2 is the odd one out, swap 1 and 2 */
+				struct shbeu_surface *tmp = src2;
+				src2 = src1;
+				src1 = tmp;
+				bblcr1 = (1 << 24);
+				bblcr0 = (2 << 24);
+			} else {
+				/* src3 is the odd one out, swap 1 and 3 */
+				struct shbeu_surface *tmp = src3;
+				src3 = src1;
+				src1 = tmp;
+				bblcr1 = (2 << 24);
+				bblcr0 = (5 << 24);
+			}
+		}
+	}
+
+	/* Default location of surfaces is (0,0) */
+	set_reg(regs, 0, BLOCR1);
+
+	/* No tile pattern */
+	set_reg(regs, 0, BTPSR);
+
+	/* Default to no byte swapping for all surfaces (YCbCr) */
+	set_reg(regs, 0, BSWPR);
+
+	/* Turn off transparent color comparison */
+	set_reg(regs, 0, BPCCR0);
+
+	/* Turn on blending */
+	set_reg(regs, 0, BPROCR);
+
+	/* Windows are placed on the output without blending */
+	for (i=0; i<nr_windows; i++)
+		bmwcr0 |= BMWCR0_MWE(i);
+	set_reg(regs, bmwcr0, BMWCR0);
+
+	/* Set parent surface; output to memory */
+	set_reg(regs, bblcr1 | BBLCR1_OUTPUT_MEM, BBLCR1);
+
+	/* Set surface order */
+	set_reg(regs, bblcr0, BBLCR0);
+
+	if (setup_src_surface(pvt, regs, 0, src1) < 0)
+		return -1;
+	if (setup_src_surface(pvt, regs, 1, src2) < 0)
+		return -1;
+	if (setup_src_surface(pvt, regs, 2, src3) < 0)
+		return -1;
+	if (setup_dst_surface(pvt, regs, dest) < 0)
+		return -1;
+	for (i=0; i<nr_windows; i++) {
+		if (setup_window(pvt, regs, i, &windows[i]) < 0)
+			return -1;
+	}
+
+	if (src2) {
+		if (different_colorspace(src1->s.format, src2->s.format)) {
+			uint32_t bsifr = get_reg(regs, BSIFR + SRC1_BASE);
+			debug_info("Setting BSIFR1 IN1TE bit");
+			bsifr  |= (BSIFR1_IN1TE | BSIFR1_IN1TM);
+			set_reg(regs, bsifr, BSIFR + SRC1_BASE);
+		}
+
+		src_check = src2;
+	}
+
+	/* Is input 1 colorspace (after the colorspace converter) RGB? */
+	if (is_rgb(src_check->s.format)) {
+		uint32_t bpkfr = get_reg(regs, BPKFR);
+		debug_info("Setting BPKFR RY bit");
+		bpkfr |= BPKFR_RY;
+		set_reg(regs, bpkfr, BPKFR);
+	}
+
+	/* Is the output colorspace different to input? */
+	if (different_colorspace(dest->s.format, src_check->s.format)) {
+		uint32_t bpkfr = get_reg(regs, BPKFR);
+		debug_info("Setting BPKFR TE bit");
+		bpkfr |= (BPKFR_TM2 | BPKFR_TM | BPKFR_DITH1 | BPKFR_TE);
+		set_reg(regs, bpkfr, BPKFR);
+	}
+
+	*start_reg = BESTR_BEIVK;
+	if (src1) *start_reg |= BESTR_CHON1;
+	if (src2) *start_reg |= BESTR_CHON2;
+	if (src3) *start_reg |= BESTR_CHON3;
+
+	/* The surface on each hardware input, after any swap */
+	if (inputs) {
+		inputs[0] = src1;
+		inputs[1] = src2;
+		inputs[2] = src3;
+	}
+
+	return 0;
+}
+
+/* Start the hardware on a job that has been programmed */
+static void start_job(SHBEU *pvt, struct beu_job *job)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+
+	/* Select the register plane holding the job */
+	write_reg(base_addr, (job->plane == PLANE_B) ? BRCHR_PLANE_B : 0, BRCHR);
+
+	/* enable interrupt */
+	write_reg_shadow(base_addr, &pvt->ctrl, 1, BEIER);
+
+	/* start operation */
+	write_reg(base_addr, job->start_reg, BESTR);
+
+	if (pvt->event_fd >= 0) {
+		pthread_mutex_lock(&pvt->irq_mutex);
+		pvt->irq_armed++;
+		pthread_cond_signal(&pvt->irq_cond);
+		pthread_mutex_unlock(&pvt->irq_mutex);
+	}
+}
+
+/* Deadline timeout_ms from now, 0 if there is none (-1 waits forever) */
+static unsigned long long get_deadline(int timeout_ms)
+{
+	if (timeout_ms < 0)
+		return 0;
+	return now_us() + timeout_ms * 1000ULL;
+}
+
+/* Milliseconds left until the deadline, -1 if there is no deadline */
+static int time_left_ms(unsigned long long deadline)
+{
+	unsigned long long now;
+
+	if (!deadline)
+		return -1;
+
+	now = now_us();
+	if (now >= deadline)
+		return 0;
+	return (deadline - now + 999) / 1000;
+}
+
+/* Consume the completion event of the oldest job, waiting up to timeout_ms
+   for it (0 does not wait, -1 waits forever).
+   Returns 1 if the job has completed, 0 if not */
+static int wait_irq(SHBEU *pvt, int timeout_ms)
+{
+	struct pollfd pfd;
+	uint64_t val;
+
+	if (pvt->event_fd < 0) {
+		uiomux_sleep(pvt->uiomux, pvt->uiores);
+		pvt->irq_us = now_us();
+		return 1;
+	}
+
+	pfd.fd = pvt->event_fd;
+	pfd.events = POLLIN;
+
+	while (read(pvt->event_fd, &val, sizeof(val)) < 0) {
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN || timeout_ms == 0)
+			return 0;
+		if (poll(&pfd, 1, timeout_ms) == 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* Wait for the oldest job to complete. The event register is polled in a
+   tight loop, then with increasing sleeps between reads, before sleeping
+   until the interrupt, giving up at the deadline (0 never gives up).
+   Returns 0 when the job has completed, -ETIMEDOUT if it has not */
+static int wait_job(SHBEU *pvt, unsigned long long deadline)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+	unsigned long *phase = &pvt->wait_stats.sleep;
+	unsigned long long done_us = 0;
+	int i, delay, slept;
+
+	/* The job was never started, see finish_job() */
+	if (pvt->stalled) {
+		debug_info("ERR: BEU was reset with jobs queued");
+		return -ETIMEDOUT;
+	}
+
+	/* Only the interrupt thread lets us give up waiting */
+	if (deadline && pvt->event_fd < 0)
+		start_irq_thread(pvt);
+
+	for (i=0; i<pvt->spin_count; i++) {
+		if (read_reg(base_addr, BEVTR) & 1) {
+			phase = &pvt->wait_stats.spin;
+			done_us = now_us();
+			goto irq;
+		}
+	}
+
+	for (delay=1, slept=0; slept<pvt->backoff_us; slept+=delay, delay*=2) {
+		usleep(delay);
+		if (read_reg(base_addr, BEVTR) & 1) {
+			phase = &pvt->wait_stats.backoff;
+			done_us = now_us();
+			goto irq;
+		}
+	}
+
+irq:
+	/* The interrupt is consumed even if the event has been seen, so that
+	   it is not taken for the interrupt of the next job */
+	if (!wait_irq(pvt, time_left_ms(deadline))) {
+		debug_info("ERR: Timed out waiting for the BEU");
+		pvt->wait_stats.timeouts++;
+		return -ETIMEDOUT;
+	}
+
+	(*phase)++;
+	pvt->done_us = done_us ? done_us : pvt->irq_us;
+	return 0;
+}
+
+/* Wait for the BEU to stop, giving up after the timeout */
+static int wait_stopped(SHBEU *pvt)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+	unsigned long long deadline = 0;
+	int i;
+
+	for (i=0; read_reg(base_addr, BSTAR) & 1; i++) {
+		if (i < BEU_STOP_SPINS)
+			continue;
+
+		if (i == BEU_STOP_SPINS && pvt->timeout_ms >= 0)
+			deadline = now_us() + pvt->timeout_ms * 1000ULL;
+		if (deadline && now_us() >= deadline) {
+			debug_info("ERR: BEU did not stop");
+			pvt->wait_stats.timeouts++;
+			return -ETIMEDOUT;
+		}
+		usleep(10);
+	}
+
+	return 0;
+}
+
+/* Add the part of rect inside a w x h output to the fixups. It is widened to
+   whole chroma samples, so that the chroma written by the hardware next to
+   it is not changed. */
+static void add_fixup(struct beu_fixup *f, const struct ren_vid_rect *rect, int w, int h)
+{
+	struct ren_vid_rect *r = &f->rects[f->nr_rects];
+	int x2 = (rect->x + rect->w + 1) & ~1;
+	int y2 = (rect->y + rect->h + 1) & ~1;
+
+	if (rect->w <= 0 || rect->h <= 0)
+		return;
+
+	r->x = rect->x & ~1;
+	r->y = rect->y & ~1;
+	r->w = ((x2 < w) ? x2 : w) - r->x;
+	r->h = ((y2 < h) ? y2 : h) - r->y;
+	f->nr_rects++;
+}
+
+/* Finish the oldest job once its interrupt has been received. The next job,
+   if any, is started, or the BEU is released, before the output of this job
+   is handled. */
+static void finish_job(SHBEU *pvt)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+	struct beu_job *job = &pvt->jobs[pvt->job_head];
+	int stopped;
+
+	/* Acknowledge interrupt, write 0 to bit 0 */
+	write_reg(base_addr, 0x100, BEVTR);
+
+	/* Wait for BEU to stop. If it does not, it is reset, which loses the
+	   registers of the next job. That job is left queued but not started,
+	   so that waiting for it fails and it is dropped or queued again by
+	   shbeu_wait_timeout(). */
+	stopped = (wait_stopped(pvt) == 0);
+	if (!stopped) {
+		invalidate_shadows(pvt);
+		pvt->clut_loaded = 0;
+		write_reg(base_addr, 1, BBRSTR);
+		wait_stopped(pvt);
+	}
+
+	pvt->job_head = (pvt->job_head + 1) % BEU_NR_JOBS;
+	pvt->nr_jobs--;
+
+	/* The next job is already in the other register plane */
+	if (!pvt->nr_jobs)
+		uiomux_unlock(pvt->uiomux, pvt->uiores);
+	else if (stopped) {
+		/* The BEU has been idle since the job finished */
+		pvt->wait_stats.restarts++;
+		pvt->wait_stats.restart_us += now_us() - pvt->done_us;
+		start_job(pvt, &pvt->jobs[pvt->job_head]);
+	} else
+		pvt->stalled = 1;
+
+	/* The job is not reused until another is submitted */
+	queue_output(pvt, job);
+}
+
+/* Wait for the oldest job to finish */
+static int complete_job(SHBEU *pvt)
+{
+	if (wait_job(pvt, get_deadline(pvt->timeout_ms)) < 0)
+		return -ETIMEDOUT;
+
+	finish_job(pvt);
+	return 0;
+}
+
+/* Write the registers of a job and start it, or leave it for finish_job() to
+   start if another job is running. There must be a free register plane. */
+static void queue_job(SHBEU *pvt, struct beu_job *job, const struct beu_regs *regs)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+	int plane;
+
+	if (pvt->nr_jobs == 0) {
+		/* NOTE: All register access must be inside this lock */
+		uiomux_lock (pvt->uiomux, pvt->uiores);
+
+		/* Other users of the BEU may have changed any register while
+		   the lock was not held. Unless no other handle has taken the
+		   lock since, or the shadows were lost, the BEU is reset. */
+		if (!owner_take(&pvt->owner) || !pvt->ctrl.valid ||
+		    (read_reg(base_addr, BSTAR) & 1)) {
+			invalidate_shadows(pvt);
+			pvt->clut_loaded = 0;
+
+			/* Reset */
+			write_reg(base_addr, 1, BBRSTR);
+
+			/* Wait for BEU to stop */
+			wait_stopped(pvt);
+		}
+
+		/* Use both register planes, each job is programmed into the
+		   plane not used by the job before it */
+		write_reg_shadow(base_addr, &pvt->ctrl, BRCNTR_PLANE_EN, BRCNTR);
+		pvt->ctrl.valid = 1;
+
+		/* The palette, see use_palette() */
+		if (job->uses_clut && !pvt->clut_loaded) {
+			int i;
+
+			for (i=0; i<256; i++)
+				write_reg(base_addr, pvt->clut[i], CLUT_BASE + i*4);
+			pvt->clut_loaded = 1;
+		}
+
+		plane = PLANE_A;
+	} else {
+		/* The running job is using the other plane */
+		plane = (pvt->jobs[pvt->job_head].plane == PLANE_A) ? PLANE_B : PLANE_A;
+	}
+
+	job->plane = plane;
+	commit_regs(base_addr + plane, &pvt->shadow[plane == PLANE_B], regs);
+
+	pvt->nr_jobs++;
+	pvt->nr_queued++;
+	if (pvt->nr_jobs == 1)
+		start_job(pvt, job);
+}
+
+/* The part of an overlay the hardware reads, which is the part inside the
+   parent, in whole multiples of 4 pixels. Overlays that are not clipped, or
+   that cannot be clipped on a multiple of 4 pixels, are returned as they
+   are. */
+static const struct shbeu_surface *
+clip_overlay(
+	struct shbeu_surface *out,
+	const struct shbeu_surface *in,
+	const struct shbeu_surface *parent)
+{
+	struct ren_vid_rect sel;
+	int x2, y2;
+
+	sel.x = (in->x < 0) ? -in->x : 0;
+	sel.y = (in->y < 0) ? -in->y : 0;
+	if ((sel.x % 4) || (sel.y % 4))
+		return in;
+
+	x2 = (parent->s.w - in->x + 3) & ~3;
+	y2 = (parent->s.h - in->y + 3) & ~3;
+	if (x2 > in->s.w) x2 = in->s.w;
+	if (y2 > in->s.h) y2 = in->s.h;
+
+	/* Nothing inside the parent, or nothing to clip */
+	if (x2 <= sel.x || y2 <= sel.y)
+		return in;
+	if (sel.x == 0 && sel.y == 0 && x2 == in->s.w && y2 == in->s.h)
+		return in;
+
+	sel.w = x2 - sel.x;
+	sel.h = y2 - sel.y;
+
+	*out = *in;
+	get_sel_surface(&out->s, &in->s, &sel);
+	out->x = in->x + sel.x;
+	out->y = in->y + sel.y;
+
+	return out;
+}
+
+/* Get the palette of the REN_PAL8 sources of a job ready. The CLUT is not
+   part of the register planes, so a different palette is only loaded when
+   the BEU is idle, by queue_job().
+   Returns 1 if the job uses the palette, 0 if not, or < 0 on error. */
+static int use_palette(SHBEU *pvt, const struct shbeu_surface *src[3])
+{
+	const unsigned int *palette = NULL;
+	int i;
+
+	for (i=0; i<3; i++) {
+		if (!src[i] || src[i]->s.format != REN_PAL8)
+			continue;
+
+		if (!src[i]->palette) {
+			debug_info("ERR: No palette!");
+			return -1;
+		}
+		if (palette && memcmp(palette, src[i]->palette, sizeof(pvt->clut))) {
+			debug_info("ERR: Sources use different palettes");
+			return -1;
+		}
+		palette = src[i]->palette;
+	}
+
+	if (!palette)
+		return 0;
+
+	if (!pvt->clut_loaded || memcmp(pvt->clut, palette, sizeof(pvt->clut))) {
+		while (pvt->nr_jobs) {
+			if (complete_job(pvt) < 0)
+				return -ETIMEDOUT;
+		}
+		memcpy(pvt->clut, palette, sizeof(pvt->clut));
+		pvt->clut_loaded = 0;
+	}
+
+	return 1;
+}
+
+/* Queue a job on the hardware. The surfaces have already been checked. */
+static int
+submit_job(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1_in,
+	const struct shbeu_surface *src2_in,
+	const struct shbeu_surface *src3_in,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest_in,
+	void (*done)(void *data),
+	void *data)
+{
+	struct beu_job *job;
+	struct shbeu_surface local_win[SHBEU_MAX_WINDOWS];
+	int i;
+	struct shbeu_surface local_src1;
+	struct shbeu_surface local_src2;
+	struct shbeu_surface local_src3;
+	struct shbeu_surface local_dest;
+	struct shbeu_surface *src1 = NULL;
+	struct shbeu_surface *src2 = NULL;
+	struct shbeu_surface *src3 = NULL;
+	struct shbeu_surface *dest = NULL;
+	struct shbeu_surface clip_src2;
+	struct shbeu_surface clip_src3;
+	const struct shbeu_surface *srcs[3] = { src1_in, src2_in, src3_in };
+	struct copy_batch batch;
+	struct beu_regs regs;
+	int uses_clut;
+
+	uses_clut = use_palette(pvt, srcs);
+	if (uses_clut < 0)
+		return uses_clut;
+
+	/* Only the part of an overlay inside the parent is bounced and read */
+	if (src2_in) src2_in = clip_overlay(&clip_src2, src2_in, src1_in);
+	if (src3_in) src3_in = clip_overlay(&clip_src3, src3_in, src1_in);
+
+	if (src1_in) src1 = &local_src1;
+	if (src2_in) src2 = &local_src2;
+	if (src3_in) src3 = &local_src3;
+	if (dest_in) dest = &local_dest;
+
+	/* Both register planes are in use, wait for the oldest job */
+	if (pvt->nr_jobs == BEU_NR_JOBS && complete_job(pvt) < 0)
+		return -ETIMEDOUT;
+
+	/* surfaces - use buffers the hardware can access */
+	if (get_hw_surface(pvt, src1, src1_in) < 0) {
+		debug_info("ERR: src1 is not accessible by hardware");
+		return -1;
+	}
+	if (get_hw_surface(pvt, src2, src2_in) < 0) {
+		debug_info("ERR: src2 is not accessible by hardware");
+		goto err_src2;
+	}
+	if (get_hw_surface(pvt, src3, src3_in) < 0) {
+		debug_info("ERR: src3 is not accessible by hardware");
+		goto err_src3;
+	}
+	if (get_hw_surface(pvt, dest, dest_in) < 0) {
+		debug_info("ERR: dest is not accessible by hardware");
+		goto err_dest;
+	}
+	for (i=0; i<nr_windows; i++) {
+		if (get_hw_surface(pvt, &local_win[i], &windows[i]) < 0) {
+			debug_info("ERR: window is not accessible by hardware");
+			goto err_win;
+		}
+	}
+
+	/* All surfaces are copied at the same time */
+	copy_batch_init(&batch);
+	if (src1_in) copy_source(&batch, src1, src1_in);
+	if (src2_in) copy_source(&batch, src2, src2_in);
+	if (src3_in) copy_source(&batch, src3, src3_in);
+	for (i=0; i<nr_windows; i++)
+		copy_source(&batch, &local_win[i], &windows[i]);
+	if (copy_run(&pvt->copy, &batch) < 0) {
+		debug_info("ERR: Could not copy the sources");
+		i = nr_windows;
+		goto err_win;
+	}
+
+	job = &pvt->jobs[(pvt->job_head + pvt->nr_jobs) % BEU_NR_JOBS];
+
+	/* Keep track of the user surfaces */
+	job->p_src1_user = (src1_in != NULL) ? &job->src1_user : NULL;
+	job->p_src2_user = (src2_in != NULL) ? &job->src2_user : NULL;
+	job->p_src3_user = (src3_in != NULL) ? &job->src3_user : NULL;
+	job->p_dest_user = (dest_in != NULL) ? &job->dest_user : NULL;
+
+	if (src1_in) job->src1_user = *src1_in;
+	if (src2_in) job->src2_user = *src2_in;
+	if (src3_in) job->src3_user = *src3_in;
+	if (dest_in) job->dest_user = *dest_in;
+
+	/* Keep track of the actual surfaces used */
+	job->src1_hw = local_src1;
+	job->src2_hw = local_src2;
+	job->src3_hw = local_src3;
+	job->dest_hw = local_dest;
+	for (i=0; i<nr_windows; i++) {
+		job->win_user[i] = windows[i];
+		job->win_hw[i] = local_win[i];
+	}
+	job->nr_windows = nr_windows;
+	job->partial = 0;
+	job->fixup.nr_rects = 0;
+	job->fixup.fill = 0;
+	job->uses_clut = uses_clut;
+	job->owned = NULL;
+	job->done = done;
+	job->done_data = data;
+
+	/* Work out all register values before touching the hardware */
+	memset(&regs, 0, sizeof(regs));
+	if (program_blend(pvt, &regs, src1, src2, src3, dest,
+			job->win_hw, nr_windows, &job->start_reg, NULL) < 0)
+		goto err;
+
+	queue_job(pvt, job, &regs);
+
+	debug_info("out");
+
+	return 0;
+
+err:
+	debug_info("ERR: error detected");
+	free_temp_bufs(pvt, job);
+	return -1;
+
+err_win:
+	while (i-- > 0)
+		free_temp_buf(pvt, &windows[i], &local_win[i]);
+	free_temp_buf(pvt, dest_in, dest);
+err_dest:
+	if (src3_in) free_temp_buf(pvt, src3_in, src3);
+err_src3:
+	if (src2_in) free_temp_buf(pvt, src2_in, src2);
+err_src2:
+	free_temp_buf(pvt, src1_in, src1);
+	return -1;
+}
+
+/* The part of a job that lies inside a rectangle of the parent surface */
+struct region {
+	struct shbeu_surface src[3];
+	int nr_srcs;
+	struct shbeu_surface win[SHBEU_MAX_WINDOWS];
+	int nr_windows;
+	struct shbeu_surface dest;
+};
+
+/* Get the part of an overlay or window that is inside rect, positioned
+   relative to rect.
+   Returns 1 if there is such a part, 0 if not, -1 if it is not aligned */
+static int
+get_region_overlay(
+	struct shbeu_surface *out,
+	const struct shbeu_surface *in,
+	const struct ren_vid_rect *rect)
+{
+	struct ren_vid_rect sel;
+	int x1, y1, x2, y2;
+
+	x1 = (in->x > rect->x) ? in->x : rect->x;
+	y1 = (in->y > rect->y) ? in->y : rect->y;
+	x2 = in->x + in->s.w;
+	y2 = in->y + in->s.h;
+	if (x2 > rect->x + rect->w) x2 = rect->x + rect->w;
+	if (y2 > rect->y + rect->h) y2 = rect->y + rect->h;
+
+	if (x2 <= x1 || y2 <= y1)
+		return 0;
+
+	sel.x = x1 - in->x;
+	sel.y = y1 - in->y;
+	sel.w = x2 - x1;
+	sel.h = y2 - y1;
+
+	if ((sel.x % 4) || (sel.y % 4) || (sel.w % 4) || (sel.h % 4)) {
+		debug_info("ERR: Overlay cannot be split on a 4 pixel boundary");
+		return -1;
+	}
+
+	*out = *in;
+	get_sel_surface(&out->s, &in->s, &sel);
+	out->x = x1 - rect->x;
+	out->y = y1 - rect->y;
+
+	return 1;
+}
+
+/* Work out the surfaces for the part of a job inside rect. Overlays and
+   windows outside rect are dropped. */
+static int
+get_region(
+	struct region *r,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect)
+{
+	const struct shbeu_surface *ovls[2] = { src2, src3 };
+	int i, ret;
+
+	r->src[0] = *src1;
+	get_sel_surface(&r->src[0].s, &src1->s, rect);
+	r->src[0].x = 0;
+	r->src[0].y = 0;
+	r->nr_srcs = 1;
+
+	r->dest = *dest;
+	get_sel_surface(&r->dest.s, &dest->s, rect);
+
+	/* Keep the blend order of the overlays that are left */
+	for (i=0; i<2; i++) {
+		if (!ovls[i])
+			continue;
+		ret = get_region_overlay(&r->src[r->nr_srcs], ovls[i], rect);
+		if (ret < 0)
+			return -1;
+		r->nr_srcs += ret;
+	}
+
+	r->nr_windows = 0;
+	for (i=0; i<nr_windows; i++) {
+		ret = get_region_overlay(&r->win[r->nr_windows], &windows[i], rect);
+		if (ret < 0)
+			return -1;
+		r->nr_windows += ret;
+	}
+
+	return 0;
+}
+
+/* Drop the overlays that cannot be seen in a region. An overlay can hide
+   the parent, or lie outside it, in one region and not in another. */
+static void cull_region(SHBEU *pvt, struct region *r)
+{
+	const struct shbeu_surface *src[3] = { NULL, NULL, NULL };
+	struct shbeu_surface layers[3];
+	struct shbeu_surface base;
+	int i;
+
+	for (i=0; i<r->nr_srcs; i++)
+		src[i] = &r->src[i];
+
+	r->nr_srcs = cull_layers(pvt, src, 3, &base);
+
+	for (i=0; i<r->nr_srcs; i++)
+		layers[i] = *src[i];
+	for (i=0; i<r->nr_srcs; i++)
+		r->src[i] = layers[i];
+}
+
+/* Queue the part of a job inside rect as a job of its own */
+static int
+submit_region(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect,
+	void (*done)(void *data),
+	void *data)
+{
+	struct region r;
+
+	if (get_region(&r, src1, src2, src3, windows, nr_windows, dest, rect) < 0)
+		return -1;
+	cull_region(pvt, &r);
+
+	return submit_job(pvt, &r.src[0],
+		(r.nr_srcs > 1) ? &r.src[1] : NULL,
+		(r.nr_srcs > 2) ? &r.src[2] : NULL,
+		r.win, r.nr_windows, &r.dest, done, data);
+}
+
+static int too_big(const struct shbeu_surface *spec)
+{
+	return (spec && (spec->s.w > BEU_MAX_SIZE || spec->s.h > BEU_MAX_SIZE));
+}
+
+/* Split a job that is too big for the hardware into strips, and queue them
+   back to back. Only the last strip calls done. */
+static int
+submit_strips(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data)
+{
+	struct ren_vid_rect rect;
+	struct region r;
+	int ret;
+	int w = src1->s.w;
+	int h = src1->s.h;
+	int nr_horz = (w + BEU_MAX_SIZE - 1) / BEU_MAX_SIZE;
+	int nr_vert = (h + BEU_MAX_SIZE - 1) / BEU_MAX_SIZE;
+	int strip_w = (((w + nr_horz - 1) / nr_horz) + 3) & ~3;
+	int strip_h = (((h + nr_vert - 1) / nr_vert) + 3) & ~3;
+	int i, check;
+
+	cache_planes(pvt, src1);
+	cache_planes(pvt, src2);
+	cache_planes(pvt, src3);
+	for (i=0; i<nr_windows; i++)
+		cache_planes(pvt, &windows[i]);
+	cache_planes(pvt, dest);
+
+	/* Check every strip before queuing any, so that a job is either
+	   queued in full or not at all */
+	for (check=1; check>=0; check--) {
+		for (rect.y=0; rect.y<h; rect.y+=strip_h) {
+			for (rect.x=0; rect.x<w; rect.x+=strip_w) {
+				int last = (rect.x + strip_w >= w && rect.y + strip_h >= h);
+
+				rect.w = (w - rect.x < strip_w) ? w - rect.x : strip_w;
+				rect.h = (h - rect.y < strip_h) ? h - rect.y : strip_h;
+
+				if (check) {
+					if (get_region(&r, src1, src2, src3, windows, nr_windows, dest, &rect) < 0)
+						return -1;
+					continue;
+				}
+
+				ret = submit_region(pvt, src1, src2, src3, windows, nr_windows, dest, &rect,
+						last ? done : NULL, last ? data : NULL);
+				if (ret < 0)
+					return ret;
+				if (!last)
+					pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].partial = 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* Queue a blend of surfaces that are a multiple of 4 pixels */
+static int
+submit_blend(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data)
+{
+	int i, split;
+
+	/* Surfaces bigger than the hardware can handle are done in strips */
+	split = too_big(src1) || too_big(src2) || too_big(src3);
+	for (i=0; i<nr_windows; i++)
+		split |= too_big(&windows[i]);
+
+	if (split)
+		return submit_strips(pvt, src1, src2, src3, windows, nr_windows,
+			dest, done, data);
+
+	return submit_job(pvt, src1, src2, src3, windows, nr_windows,
+		dest, done, data);
+}
+
+static int is_aligned(const struct shbeu_surface *spec)
+{
+	return (!spec || (!(spec->s.w % 4) && !(spec->s.h % 4)));
+}
+
+/* Trim an overlay or window to the part inside the w x h output that the
+   hardware can do. The rest is added to the fixups.
+   Returns 1 if the hardware has anything to do, 0 if not */
+static int
+trim_overlay(
+	struct shbeu_surface *out,
+	const struct shbeu_surface *in,
+	int w, int h,
+	struct beu_fixup *f)
+{
+	struct ren_vid_rect rect;
+	int x2 = (in->x + in->s.w < w) ? in->x + in->s.w : w;
+	int y2 = (in->y + in->s.h < h) ? in->y + in->s.h : h;
+	int aw = (x2 - in->x) & ~3;
+	int ah = (y2 - in->y) & ~3;
+
+	if (x2 <= in->x || y2 <= in->y)
+		return 0;
+
+	/* Right hand columns */
+	rect.x = in->x + aw;
+	rect.y = in->y;
+	rect.w = x2 - rect.x;
+	rect.h = y2 - rect.y;
+	add_fixup(f, &rect, w, h);
+
+	/* Bottom rows */
+	rect.x = in->x;
+	rect.y = in->y + ah;
+	rect.w = aw;
+	rect.h = y2 - rect.y;
+	add_fixup(f, &rect, w, h);
+
+	if (!aw || !ah)
+		return 0;
+
+	*out = *in;
+	out->s.w = aw;
+	out->s.h = ah;
+
+	return 1;
+}
+
+/* Blend surfaces that are not a multiple of 4 pixels. The hardware blends
+   the largest part it can, and the rest is done in software. The edges of
+   the output are done while the hardware is running, the parts of the
+   overlays and windows inside it once the hardware has finished. */
+static int
+submit_unaligned(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data)
+{
+	const struct shbeu_surface *ovls[2] = { src2, src3 };
+	struct shbeu_surface hw_src[3];
+	struct shbeu_surface hw_win[SHBEU_MAX_WINDOWS];
+	struct shbeu_surface hw_dest;
+	struct beu_fixup fix, edges;
+	struct ren_vid_rect rect;
+	int w = src1->s.w & ~3;
+	int h = src1->s.h & ~3;
+	int nr_srcs = 1, nr_win = 0, i, ret;
+
+	/* Too small for the hardware */
+	if (!w || !h) {
+		if (cpu_blend(src1, src2, src3, windows, nr_windows, dest, NULL) < 0)
+			return -1;
+		if (done)
+			done(data);
+		return 0;
+	}
+
+	fix.src[0] = *src1;
+	fix.nr_srcs = 1;
+	for (i=0; i<2; i++) {
+		if (ovls[i])
+			fix.src[fix.nr_srcs++] = *ovls[i];
+	}
+	for (i=0; i<nr_windows; i++)
+		fix.win[i] = windows[i];
+	fix.nr_windows = nr_windows;
+	fix.dest = *dest;
+	fix.nr_rects = 0;
+	fix.fill = 0;
+
+	hw_src[0] = *src1;
+	hw_src[0].s.w = w;
+	hw_src[0].s.h = h;
+	hw_dest = *dest;
+	hw_dest.s.w = w;
+	hw_dest.s.h = h;
+
+	for (i=1; i<fix.nr_srcs; i++)
+		nr_srcs += trim_overlay(&hw_src[nr_srcs], &fix.src[i], w, h, &fix);
+	for (i=0; i<nr_windows; i++)
+		nr_win += trim_overlay(&hw_win[nr_win], &windows[i], w, h, &fix);
+
+	ret = submit_blend(pvt, &hw_src[0],
+			(nr_srcs > 1) ? &hw_src[1] : NULL,
+			(nr_srcs > 2) ? &hw_src[2] : NULL,
+			hw_win, nr_win, &hw_dest, done, data);
+	if (ret < 0)
+		return ret;
+
+	/* The fixups are done before the callback of the last job */
+	if (fix.nr_rects)
+		pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].fixup = fix;
+
+	/* The hardware does not write the edges, so they can be done now */
+	edges = fix;
+	edges.nr_rects = 0;
+	rect.x = w;
+	rect.y = 0;
+	rect.w = src1->s.w - w;
+	rect.h = src1->s.h;
+	add_fixup(&edges, &rect, src1->s.w, src1->s.h);
+	rect.x = 0;
+	rect.y = h;
+	rect.w = w;
+	rect.h = src1->s.h - h;
+	add_fixup(&edges, &rect, src1->s.w, src1->s.h);
+	run_fixups(&edges);
+
+	return 0;
+}
+
+/* Check the surfaces of a blend fit together */
+static int
+check_blend(
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest)
+{
+	/* Check we have been passed at least an input and an output */
+	if (!src1 || !dest) {
+		debug_info("ERR: Invalid input - need at least 1 src and dest");
+		return -1;
+	}
+
+	/* Check the size of the destination surface is big enough */
+	if (dest->s.pitch < src1->s.w) {
+		debug_info("ERR: Size of the destination surface is not big enough");
+		return -1;
+	}
+
+	/* Check the size of the destination surface matches the parent surface */
+	if (dest->s.w != src1->s.w || dest->s.h != src1->s.h) {
+		debug_info("ERR: Size of the destination surface does NOT match the parent surface");
+		return -1;
+	}
+
+	if (is_tile(src1) && (src1->tile_w <= 0 || src1->tile_h <= 0 ||
+	    (src1->tile_w % 4) || (src1->tile_h % 4) ||
+	    src1->tile_w > BEU_MAX_SIZE || src1->tile_h > BEU_MAX_SIZE ||
+	    src1->s.pitch < src1->tile_w)) {
+		debug_info("ERR: Tile size invalid");
+		return -1;
+	}
+
+	if (is_tile(dest)) {
+		debug_info("ERR: Only the parent surface can be tiled");
+		return -1;
+	}
+
+	if (is_keyed(src1) || is_keyed(dest)) {
+		debug_info("ERR: Only overlays can be keyed");
+		return -1;
+	}
+
+	return check_windows(src1, windows, nr_windows, dest);
+}
+
+/* Wait for the oldest blend to finish */
+static int wait_blend(SHBEU *pvt)
+{
+	/* Nothing to wait for if no job is running. This is always the case
+	   for software blends as they are complete when started. A blend split
+	   into strips is complete when its last strip is. */
+	while (pvt->nr_jobs) {
+		int partial = pvt->jobs[pvt->job_head].partial;
+
+		if (complete_job(pvt) < 0)
+			return -ETIMEDOUT;
+		if (!partial)
+			break;
+	}
+
+	wait_tasks(pvt);
+	return 0;
+}
+
+/* Wait for all blends to finish */
+int flush_blends(SHBEU *pvt)
+{
+	while (pvt->nr_jobs) {
+		if (complete_job(pvt) < 0)
+			return -ETIMEDOUT;
+	}
+
+	wait_tasks(pvt);
+	return 0;
+}
+
+/* Drop the overlays of a blend that cannot be seen: those that are fully
+   transparent or outside the parent, and those under an opaque overlay
+   that covers the whole output. Such an overlay becomes the parent, using
+   base for its surface. The nr_src inputs in src[] are bottom first, and
+   any but the parent can be NULL. The inputs left are moved to the start
+   of src[], the other entries are set to NULL, and the number left is
+   returned. */
+int cull_layers(SHBEU *pvt, const struct shbeu_surface **src, int nr_src,
+	struct shbeu_surface *base)
+{
+	int w = src[0]->s.w;
+	int h = src[0]->s.h;
+	int i, nr = 1, nr_in = 1;
+
+	for (i=1; i<nr_src; i++) {
+		const struct shbeu_surface *layer = src[i];
+
+		if (!layer)
+			continue;
+		nr_in++;
+
+		if (!is_visible(layer, w, h)) {
+			pvt->cull_stats.invisible++;
+			continue;
+		}
+
+		if (is_opaque(layer) && covers(layer, w, h)) {
+			/* Use the part of the layer that covers the output */
+			*base = *layer;
+			base->s.w = w;
+			base->s.h = h;
+			pvt->cull_stats.hidden += nr;
+			src[0] = base;
+			nr = 1;
+			continue;
+		}
+
+		src[nr++] = layer;
+	}
+
+	if (nr == 1 && nr_in > 1)
+		pvt->cull_stats.collapsed++;
+
+	for (i=nr; i<nr_src; i++)
+		src[i] = NULL;
+
+	return nr;
+}
+
+int
+shbeu_submit_windows(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1_in,
+	const struct shbeu_surface *src2_in,
+	const struct shbeu_surface *src3_in,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest_in,
+	void (*done)(void *data),
+	void *data)
+{
+	const struct shbeu_surface *src[3] = { src1_in, src2_in, src3_in };
+	struct shbeu_surface base;
+	struct shbeu_surface expanded;
+	size_t expanded_len;
+	unsigned long nr_queued = pvt ? pvt->nr_queued : 0;
+	int i, ret, unaligned = 0, expand = 0;
+
+	debug_info("in");
+
+	if (!pvt || check_blend(src1_in, windows, nr_windows, dest_in) < 0)
+		return -1;
+
+	if (is_tile(src2_in) || is_tile(src3_in)) {
+		debug_info("ERR: Only the parent surface can be tiled");
+		return -1;
+	}
+
+	/* Layers that cannot be seen are not fetched or bounced */
+	cull_layers(pvt, src, 3, &base);
+	src1_in = src[0];
+	src2_in = src[1];
+	src3_in = src[2];
+
+	if (!is_aligned(src1_in) || !is_aligned(src2_in) || !is_aligned(src3_in))
+		unaligned = 1;
+	for (i=0; i<nr_windows; i++)
+		unaligned |= !is_aligned(&windows[i]);
+
+	/* The hardware repeats a tile on input 1 in a single pass, and so
+	   does the CPU. Otherwise, the tile is repeated in memory. */
+	if (is_tile(src1_in) && !pvt->cpu) {
+		expand = unaligned || too_big(src1_in) ||
+			(src2_in && src3_in && different_colorspace(src2_in->s.format, src3_in->s.format));
+	}
+
+	/* The CPU cannot access physical surfaces */
+	if (pvt->cpu || unaligned || expand) {
+		int phys = is_phys(src1_in);
+
+		if (pvt->cpu || unaligned) {
+			phys |= is_phys(src2_in) || is_phys(src3_in) || is_phys(dest_in);
+			for (i=0; i<nr_windows; i++)
+				phys |= is_phys(&windows[i]);
+		}
+		if (phys) {
+			debug_info("ERR: Physical surfaces must be blended by the hardware");
+			return -1;
+		}
+	}
+
+	if (expand) {
+		if (expand_tile(pvt, &expanded, src1_in, &expanded_len) < 0)
+			return -1;
+		src1_in = &expanded;
+	}
+
+	if (pvt->cpu) {
+		ret = cpu_blend(src1_in, src2_in, src3_in, windows, nr_windows, dest_in, NULL);
+		if (ret == 0 && done)
+			done(data);
+	} else if (unaligned) {
+		ret = submit_unaligned(pvt, src1_in, src2_in, src3_in, windows, nr_windows,
+			dest_in, done, data);
+	} else {
+		ret = submit_blend(pvt, src1_in, src2_in, src3_in, windows, nr_windows,
+			dest_in, done, data);
+	}
+
+	/* The hardware and the fixups read the copy until the last job of
+	   the blend has finished, so that job frees it */
+	if (expand) {
+		if (pvt->nr_queued != nr_queued && pvt->nr_jobs) {
+			struct beu_job *job = &pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS];
+
+			job->owned = expanded.s.py;
+			job->owned_len = expanded_len;
+		} else {
+			wait_tasks(pvt);
+			bounce_put(&pvt->bounce, expanded.s.py, expanded_len);
+		}
+	}
+
+	return ret;
+}
+
+int
+shbeu_submit(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data)
+{
+	return shbeu_submit_windows(pvt, src1, src2, src3, NULL, 0, dest, done, data);
+}
+
+int
+shbeu_start_blend(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest)
+{
+	return shbeu_submit(pvt, src1, src2, src3, dest, NULL, NULL);
+}
+
+/* Reset a BEU that has stopped responding, and drop all of its jobs. The
+   dropped jobs are copied to aborted[], oldest first, if it is not NULL.
+   Returns the number of jobs dropped */
+static int abort_jobs(SHBEU *pvt, struct beu_job *aborted)
+{
+	void *base_addr = pvt->uio_mmio.iomem;
+	uint64_t val;
+	int i, nr = pvt->nr_jobs;
+
+	debug_info("Resetting the BEU");
+
+	write_reg(base_addr, 1, BBRSTR);
+	wait_stopped(pvt);
+	invalidate_shadows(pvt);
+	pvt->clut_loaded = 0;
+
+	for (i=0; i<nr; i++) {
+		struct beu_job *job = &pvt->jobs[(pvt->job_head + i) % BEU_NR_JOBS];
+
+		if (aborted)
+			aborted[i] = *job;
+		free_temp_bufs(pvt, job);
+	}
+	pvt->nr_jobs = 0;
+	pvt->stalled = 0;
+
+	uiomux_unlock(pvt->uiomux, pvt->uiores);
+
+	/* The interrupt thread may be waiting for an interrupt that will
+	   never come. Start again with no events pending. */
+	if (pvt->event_fd >= 0 && !pvt->cpu) {
+		end_irq_thread(pvt);
+		while (read(pvt->event_fd, &val, sizeof(val)) > 0)
+			;
+		if (run_irq_thread(pvt) < 0) {
+			debug_info("ERR: Could not restart the interrupt thread");
+			close(pvt->event_fd);
+			pvt->event_fd = -1;
+		}
+	}
+
+	return nr;
+}
+
+/* Queue a job that was dropped by abort_jobs() again */
+static int resubmit_job(SHBEU *pvt, struct beu_job *job)
+{
+	struct beu_job *new_job;
+	int ret;
+
+	ret = submit_job(pvt,
+		job->p_src1_user ? &job->src1_user : NULL,
+		job->p_src2_user ? &job->src2_user : NULL,
+		job->p_src3_user ? &job->src3_user : NULL,
+		job->win_user, job->nr_windows,
+		job->p_dest_user ? &job->dest_user : NULL,
+		job->done, job->done_data);
+	if (ret < 0)
+		return ret;
+
+	new_job = &pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS];
+	new_job->partial = job->partial;
+	new_job->fixup = job->fixup;
+	new_job->owned = job->owned;
+	new_job->owned_len = job->owned_len;
+
+	return 0;
+}
+
+/* Give up on a job dropped by abort_jobs(). Its output is left as it is,
+   but the callback is still made, so that every blend gets one. */
+static void drop_job(SHBEU *pvt, struct beu_job *job)
+{
+	if (job->owned)
+		bounce_put(&pvt->bounce, job->owned, job->owned_len);
+
+	if (job->done)
+		job->done(job->done_data);
+}
+
+int
+shbeu_wait_timeout(SHBEU *pvt, int timeout_ms, int flags)
+{
+	struct beu_job aborted[BEU_NR_JOBS];
+	struct beu_job requeued[BEU_NR_JOBS];
+	unsigned long long deadline;
+	int i, j, nr, resubmit, ret = -ETIMEDOUT;
+
+	if (!pvt)
+		return -1;
+
+	/* The timeout is for the whole blend, however many jobs it has */
+	deadline = get_deadline(timeout_ms);
+
+	while (pvt->nr_jobs) {
+		int partial = pvt->jobs[pvt->job_head].partial;
+
+		if (wait_job(pvt, deadline) < 0)
+			break;
+
+		finish_job(pvt);
+		if (!partial) {
+			wait_tasks(pvt);
+			return 0;
+		}
+	}
+
+	if (!pvt->nr_jobs) {
+		wait_tasks(pvt);
+		return 0;
+	}
+
+	nr = abort_jobs(pvt, aborted);
+
+	/* Callbacks of finished jobs are made before those of dropped ones */
+	wait_tasks(pvt);
+
+	resubmit = (flags & SHBEU_RESUBMIT);
+	for (i=0; i<nr; i++) {
+		if (resubmit && resubmit_job(pvt, &aborted[i]) == 0)
+			continue;
+
+		if (resubmit) {
+			debug_info("ERR: Could not resubmit a blend");
+			resubmit = 0;
+			ret = -1;
+
+			/* The jobs that were queued again may read buffers owned
+			   by the jobs that could not be, so they are dropped too */
+			if (pvt->nr_jobs) {
+				int nr_requeued = abort_jobs(pvt, requeued);
+
+				for (j=0; j<nr_requeued; j++)
+					drop_job(pvt, &requeued[j]);
+			}
+		}
+		drop_job(pvt, &aborted[i]);
+	}
+
+	return ret;
+}
+
+void
+shbeu_wait(SHBEU *pvt)
+{
+	debug_info("in");
+
+	wait_blend(pvt);
+
+	debug_info("out");
+}
+
+void
+shbeu_flush(SHBEU *pvt)
+{
+	flush_blends(pvt);
+}
+
+int
+shbeu_set_wait_policy(SHBEU *pvt, int spin_count, int backoff_us, int timeout_ms)
+{
+	if (!pvt || spin_count < 0 || backoff_us < 0)
+		return -1;
+
+	pvt->spin_count = spin_count;
+	pvt->backoff_us = backoff_us;
+	pvt->timeout_ms = (timeout_ms < 0) ? SHBEU_WAIT_FOREVER : timeout_ms;
+
+	return 0;
+}
+
+int
+shbeu_get_wait_stats(SHBEU *pvt, struct shbeu_wait_stats *stats)
+{
+	if (!pvt || !stats)
+		return -1;
+
+	*stats = pvt->wait_stats;
+	return 0;
+}
+
+int
+shbeu_get_cull_stats(SHBEU *pvt, struct shbeu_cull_stats *stats)
+{
+	if (!pvt || !stats)
+		return -1;
+
+	*stats = pvt->cull_stats;
+	return 0;
+}
+
+int
+shbeu_get_fd(SHBEU *pvt)
+{
+	if (!pvt)
+		return -1;
+
+	if (pvt->event_fd < 0 && start_irq_thread(pvt) < 0) {
+		debug_info("ERR: Could not create event fd");
+		return -1;
+	}
+
+	return pvt->event_fd;
+}
+
+int
+shbeu_try_complete(SHBEU *pvt)
+{
+	if (!pvt)
+		return -1;
+
+	if (!pvt->nr_jobs || pvt->event_fd < 0)
+		return 0;
+
+	if (!wait_irq(pvt, 0))
+		return 0;
+
+	pvt->done_us = pvt->irq_us;
+	finish_job(pvt);
+
+	return 1;
+}
+
+
 int
-shbeu_start_blend(
+shbeu_blend(
 	SHBEU *pvt,
-	const struct shbeu_surface *src1_in,
-	const struct shbeu_surface *src2_in,
-	const struct shbeu_surface *src3_in,
-	const struct shbeu_surface *dest_in)
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest)
 {
-	uint32_t start_reg;
-	uint32_t control_reg;
-	const struct shbeu_surface *src_check;
-	uint32_t bblcr1 = 0;
-	uint32_t bblcr0 = 0;
-	struct shbeu_surface local_src1;
-	struct shbeu_surface local_src2;
-	struct shbeu_surface local_src3;
-	struct shbeu_surface local_dest;
-	struct shbeu_surface *src1 = NULL;
-	struct shbeu_surface *src2 = NULL;
-	struct shbeu_surface *src3 = NULL;
-	struct shbeu_surface *dest = NULL;
-	void *base_addr;
+	int ret = 0;
 
-	debug_info("in");
+	ret = shbeu_start_blend(pvt, src1, src2, src3, dest);
 
-	if (src1_in) src1 = &local_src1;
-	if (src2_in) src2 = &local_src2;
-	if (src3_in) src3 = &local_src3;
-	if (dest_in) dest = &local_dest;
+	if (ret == 0)
+		ret = wait_blend(pvt);
 
-	/* Check we have been passed at least an input and an output */
-	if (!pvt || !src1_in || !dest_in) {
-		debug_info("ERR: Invalid input - need at least 1 src and dest");
+	return ret;
+}
+
+int
+shbeu_blend_windows(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest)
+{
+	int ret = 0;
+
+	ret = shbeu_submit_windows(pvt, src1, src2, src3, windows, nr_windows, dest, NULL, NULL);
+
+	if (ret == 0)
+		ret = flush_blends(pvt);
+
+	return ret;
+}
+
+/* Fill rect of dest with the fill tile. rect is a multiple of 4 pixels and
+   small enough for the hardware. */
+static int fill_tiled(SHBEU *pvt, const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect)
+{
+	struct shbeu_surface src;
+	struct shbeu_surface out;
+
+	/* The part of dest to fill */
+	out = *dest;
+	out.s.w = rect->w;
+	out.s.h = rect->h;
+	if (out.s.py) out.s.py += offset_y(out.s.format, rect->x, rect->y, out.s.pitch);
+	if (out.s.pc) out.s.pc += offset_c(out.s.format, rect->x, rect->y, out.s.pitch);
+	if (out.s.pa) out.s.pa += offset_a(out.s.format, rect->x, rect->y, out.s.pitch);
+
+	/* A 4x4 tile of the colour is repeated over the area */
+	memset(&src, 0, sizeof(src));
+	src.s.format = REN_RGB32;
+	src.s.w = rect->w;
+	src.s.h = rect->h;
+	src.s.pitch = 4;
+	src.s.py = pvt->fill_tile;
+	src.alpha = 255;
+	src.flags = SHBEU_TILE;
+	src.tile_w = 4;
+	src.tile_h = 4;
+
+	return submit_blend(pvt, &src, NULL, NULL, NULL, 0, &out, NULL, NULL);
+}
+
+int
+shbeu_fill(
+	SHBEU *pvt,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect,
+	unsigned int rgb,
+	void (*done)(void *data),
+	void *data)
+{
+	struct ren_vid_rect all, piece;
+	struct beu_fixup edges;
+	struct beu_job *job;
+	uint32_t color = rgb & 0xFFFFFF;
+	unsigned long nr_queued;
+	int aw, ah, x, y, i, ret;
+
+	if (!pvt || !dest)
 		return -1;
+
+	if (!rect) {
+		all.x = 0;
+		all.y = 0;
+		all.w = dest->s.w;
+		all.h = dest->s.h;
+		rect = &all;
 	}
 
-	/* Check the size of the destination surface is big enough */
-	if (dest_in->s.pitch < src1_in->s.w) {
-		debug_info("ERR: Size of the destination surface is not big enough");
+	if (rect->x < 0 || rect->y < 0 || rect->w <= 0 || rect->h <= 0 ||
+	    rect->x + rect->w > dest->s.w || rect->y + rect->h > dest->s.h) {
+		debug_info("ERR: Fill area is outside the surface");
 		return -1;
 	}
 
-	/* Check the size of the destination surface matches the parent surface */
-	if (dest_in->s.w != src1_in->s.w || dest_in->s.h != src1_in->s.h) {
-		debug_info("ERR: Size of the destination surface does NOT match the parent surface");
+	/* The hardware fills whole multiples of 4 pixels, the CPU does the
+	   rest, writing the colour directly */
+	aw = pvt->cpu ? 0 : rect->w & ~3;
+	ah = pvt->cpu ? 0 : rect->h & ~3;
+
+	if ((aw < rect->w || ah < rect->h) && is_phys(dest)) {
+		debug_info("ERR: Physical surfaces must be filled by the hardware");
 		return -1;
 	}
 
-	/* surfaces - use buffers the hardware can access */
-	if (get_hw_surface(pvt, src1, src1_in) < 0) {
-		debug_info("ERR: src1 is not accessible by hardware");
-		return -1;
+	if (!aw || !ah) {
+		ret = flush_blends(pvt);
+		if (ret < 0)
+			return ret;
+		if (cpu_fill(dest, rect, color) < 0)
+			return -1;
+		if (done)
+			done(data);
+		return 0;
 	}
-	if (get_hw_surface(pvt, src2, src2_in) < 0) {
-		debug_info("ERR: src2 is not accessible by hardware");
-		return -1;
+
+	/* The tile is read again if a job is resubmitted, so queued jobs must
+	   finish before it changes colour */
+	if (!pvt->fill_tile) {
+		pvt->fill_tile = uiomux_malloc(pvt->uiomux, pvt->uiores,
+			FILL_TILE_SIZE, 32);
+		if (!pvt->fill_tile)
+			return -1;
+		pvt->fill_color = ~color;
 	}
-	if (get_hw_surface(pvt, src3, src3_in) < 0) {
-		debug_info("ERR: src3 is not accessible by hardware");
-		return -1;
+	if (pvt->fill_color != color) {
+		ret = flush_blends(pvt);
+		if (ret < 0)
+			return ret;
+		for (i=0; i<4*4; i++)
+			pvt->fill_tile[i] = color;
+		pvt->fill_color = color;
 	}
-	if (get_hw_surface(pvt, dest, dest_in) < 0) {
-		debug_info("ERR: dest is not accessible by hardware");
-		return -1;
+
+	/* In pieces the hardware can address, all but the last are partial */
+	nr_queued = pvt->nr_queued;
+	for (y=0; y<ah; y+=BEU_MAX_SIZE) {
+		for (x=0; x<aw; x+=BEU_MAX_SIZE) {
+			piece.x = rect->x + x;
+			piece.y = rect->y + y;
+			piece.w = (aw - x < BEU_MAX_SIZE) ? aw - x : BEU_MAX_SIZE;
+			piece.h = (ah - y < BEU_MAX_SIZE) ? ah - y : BEU_MAX_SIZE;
+
+			if (pvt->nr_queued != nr_queued && pvt->nr_jobs)
+				pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].partial = 1;
+
+			ret = fill_tiled(pvt, dest, &piece);
+			if (ret < 0) {
+				/* The rest of the fill is dropped */
+				if (pvt->nr_queued != nr_queued && pvt->nr_jobs)
+					pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].partial = 0;
+				return ret;
+			}
+		}
 	}
 
-	if (src1_in) copy_surface(&src1->s, &src1_in->s);
-	if (src2_in) copy_surface(&src2->s, &src2_in->s);
-	if (src3_in) copy_surface(&src3->s, &src3_in->s);
+	/* The right and bottom edges are done after the last job */
+	edges.dest = *dest;
+	edges.nr_rects = 0;
+	edges.fill = 1;
+	edges.rgb = color;
+	if (aw < rect->w) {
+		piece.x = rect->x + aw;
+		piece.y = rect->y;
+		piece.w = rect->w - aw;
+		piece.h = rect->h;
+		edges.rects[edges.nr_rects++] = piece;
+	}
+	if (ah < rect->h) {
+		piece.x = rect->x;
+		piece.y = rect->y + ah;
+		piece.w = aw;
+		piece.h = rect->h - ah;
+		edges.rects[edges.nr_rects++] = piece;
+	}
 
-	/* NOTE: All register access must be inside this lock */
-	uiomux_lock (pvt->uiomux, pvt->uiores);
+	job = &pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS];
+	if (pvt->nr_jobs && !job->fixup.nr_rects && !job->done) {
+		if (edges.nr_rects)
+			job->fixup = edges;
+		job->done = done;
+		job->done_data = data;
+		return 0;
+	}
 
-	base_addr = pvt->uio_mmio.iomem;
+	/* The pieces were finished without a job left to hold the edges */
+	ret = flush_blends(pvt);
+	if (ret < 0)
+		return ret;
+	for (i=0; i<edges.nr_rects; i++)
+		cpu_fill(dest, &edges.rects[i], color);
+	if (done)
+		done(data);
 
-	/* Keep track of the user surfaces */
-	pvt->p_src1_user = (src1_in != NULL) ? &pvt->src1_user : NULL;
-	pvt->p_src2_user = (src2_in != NULL) ? &pvt->src2_user : NULL;
-	pvt->p_src3_user = (src3_in != NULL) ? &pvt->src3_user : NULL;
-	pvt->p_dest_user = (dest_in != NULL) ? &pvt->dest_user : NULL;
+	return 0;
+}
 
-	if (src1_in) pvt->src1_user = *src1_in;
-	if (src2_in) pvt->src2_user = *src2_in;
-	if (src3_in) pvt->src3_user = *src3_in;
-	if (dest_in) pvt->dest_user = *dest_in;
 
-	/* Keep track of the actual surfaces used */
-	pvt->src1_hw = local_src1;
-	pvt->src2_hw = local_src2;
-	pvt->src3_hw = local_src3;
-	pvt->dest_hw = local_dest;
-	src_check = src1;
+/* Recomposition of damaged areas */
 
-	/* Ensure src2 and src3 formats are the same type (only input 1 on the
-	   hardware has colorspace conversion */
-	if (src2 && src3) {
-		if (different_colorspace(src2->s.format, src3->s.format)) {
-			if (different_colorspace(src1->s.format, src2->s.format)) {
-				/* src2 is the odd one out, swap 1 and 2 */
-				struct shbeu_surface *tmp = src2;
-				src2 = src1;
-				src1 = tmp;
-				bblcr1 = (1 << 24);
-				bblcr0 = (2 << 24);
+/* Round a damage rectangle out to multiples of 4 pixels, inside a w x h
+   output. Returns 0 if nothing is left. */
+static int align_damage(struct ren_vid_rect *out, const struct ren_vid_rect *in, int w, int h)
+{
+	int x1 = (in->x > 0) ? in->x & ~3 : 0;
+	int y1 = (in->y > 0) ? in->y & ~3 : 0;
+	int x2 = (in->x + in->w + 3) & ~3;
+	int y2 = (in->y + in->h + 3) & ~3;
+
+	if (x2 > w) x2 = w;
+	if (y2 > h) y2 = h;
+	if (in->w <= 0 || in->h <= 0 || x2 <= x1 || y2 <= y1)
+		return 0;
+
+	out->x = x1;
+	out->y = y1;
+	out->w = x2 - x1;
+	out->h = y2 - y1;
+	return 1;
+}
+
+/* Is rectangle a inside rectangle b? */
+static int rect_inside(const struct ren_vid_rect *a, const struct ren_vid_rect *b)
+{
+	return (a->x >= b->x && a->y >= b->y &&
+		a->x + a->w <= b->x + b->w && a->y + a->h <= b->y + b->h);
+}
+
+int
+shbeu_submit_damage(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rects,
+	int nr_rects,
+	void (*done)(void *data),
+	void *data)
+{
+	struct ren_vid_rect damage[SHBEU_MAX_DAMAGE];
+	struct region r;
+	long area = 0;
+	int i, j, nr = 0, ret;
+
+	if (!pvt || check_blend(src1, NULL, 0, dest) < 0 || nr_rects < 0 || (nr_rects && !rects))
+		return -1;
+
+	/* Too much damage to be worth tracking. Tiled parents are not split
+	   into areas. */
+	if (nr_rects > SHBEU_MAX_DAMAGE || is_tile(src1))
+		return shbeu_submit(pvt, src1, src2, src3, dest, done, data);
+
+	/* The hardware only works on multiples of 4 pixels */
+	if (!pvt->cpu && (!is_aligned(src1) || !is_aligned(src2) || !is_aligned(src3)))
+		return shbeu_submit(pvt, src1, src2, src3, dest, done, data);
+
+	/* Both backends blend the same areas, clipped to the parent */
+	for (i=0; i<nr_rects; i++) {
+		if (align_damage(&damage[nr], &rects[i], src1->s.w, src1->s.h))
+			nr++;
+	}
+
+	/* Drop areas that are part of another area */
+	for (i=0; i<nr; i++) {
+		for (j=0; j<nr; j++) {
+			if (j != i && rect_inside(&damage[i], &damage[j]) &&
+			    (!rect_inside(&damage[j], &damage[i]) || j < i)) {
+				damage[i--] = damage[--nr];
+				break;
+			}
+		}
+	}
+
+	if (pvt->cpu) {
+		if (is_phys(src1) || is_phys(src2) || is_phys(src3) || is_phys(dest)) {
+			debug_info("ERR: Physical surfaces must be blended by the hardware");
+			return -1;
+		}
+
+		/* The areas are inside the parent, so only the surfaces can be
+		   wrong, and that is found before the first area is written.
+		   Overlays cut off the 4 pixel grid are blended without culling. */
+		for (i=0; i<nr; i++) {
+			if (get_region(&r, src1, src2, src3, NULL, 0, dest, &damage[i]) < 0) {
+				ret = cpu_blend(src1, src2, src3, NULL, 0, dest, &damage[i]);
 			} else {
-				/* src3 is the odd one out, swap 1 and 3 */
-				struct shbeu_surface *tmp = src3;
-				src3 = src1;
-				src1 = tmp;
-				bblcr1 = (2 << 24);
-				bblcr0 = (5 << 24);
+				cull_region(pvt, &r);
+				ret = cpu_blend(&r.src[0],
+					(r.nr_srcs > 1) ? &r.src[1] : NULL,
+					(r.nr_srcs > 2) ? &r.src[2] : NULL,
+					NULL, 0, &r.dest, NULL);
 			}
+			if (ret < 0)
+				return -1;
 		}
+		if (done)
+			done(data);
+		return 0;
 	}
 
-	if (read_reg(base_addr, BSTAR)) {
-		debug_info("BEU appears to be running already...");
+	if (nr == 0) {
+		if (done)
+			done(data);
+		return 0;
 	}
 
-	/* Reset */
-	write_reg(base_addr, 1, BBRSTR);
+	/* Use a single blend if it is no more work, or if an area is too big
+	   or cuts through an overlay at a point the hardware cannot */
+	for (i=0; i<nr; i++) {
+		area += (long)damage[i].w * damage[i].h;
+		if (damage[i].w > BEU_MAX_SIZE || damage[i].h > BEU_MAX_SIZE ||
+		    get_region(&r, src1, src2, src3, NULL, 0, dest, &damage[i]) < 0)
+			break;
+	}
+	if (i < nr || area >= (long)src1->s.w * src1->s.h)
+		return shbeu_submit(pvt, src1, src2, src3, dest, done, data);
+
+	cache_planes(pvt, src1);
+	cache_planes(pvt, src2);
+	cache_planes(pvt, src3);
+	cache_planes(pvt, dest);
+
+	/* The areas are queued back to back, only the last calls done */
+	for (i=0; i<nr; i++) {
+		int last = (i == nr - 1);
+
+		ret = submit_region(pvt, src1, src2, src3, NULL, 0, dest, &damage[i],
+				last ? done : NULL, last ? data : NULL);
+		if (ret < 0) {
+			/* The areas already queued are a blend of their own */
+			if (i > 0 && pvt->nr_jobs)
+				pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].partial = 0;
+			return ret;
+		}
+		if (!last)
+			pvt->jobs[(pvt->job_head + pvt->nr_jobs - 1) % BEU_NR_JOBS].partial = 1;
+	}
 
-	/* Wait for BEU to stop */
-	while (read_reg(base_addr, BSTAR) & 1)
-		;
+	return 0;
+}
 
-	/* Turn off register bank/plane access, access regs via Plane A */
-	write_reg(base_addr, 0, BRCNTR);
-	write_reg(base_addr, 0, BRCHR);
+int
+shbeu_blend_damage(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rects,
+	int nr_rects)
+{
+	int ret;
 
-	/* Default location of surfaces is (0,0) */
-	write_reg(base_addr, 0, BLOCR1);
+	ret = shbeu_submit_damage(pvt, src1, src2, src3, dest, rects, nr_rects, NULL, NULL);
 
-	/* Default to no byte swapping for all surfaces (YCbCr) */
-	write_reg(base_addr, 0, BSWPR);
+	if (ret == 0)
+		ret = wait_blend(pvt);
 
-	/* Turn off transparent color comparison */
-	write_reg(base_addr, 0, BPCCR0);
+	return ret;
+}
 
-	/* Turn on blending */
-	write_reg(base_addr, 0, BPROCR);
 
-	/* Not using "multi-window" capability */
-	write_reg(base_addr, 0, BMWCR0);
+/* Blend plans */
 
-	/* Set parent surface; output to memory */
-	write_reg(base_addr, bblcr1 | BBLCR1_OUTPUT_MEM, BBLCR1);
+struct shbeu_plan {
+	SHBEU *beu;
+	struct shbeu_surface spec[4];	/* src1, src2, src3, dest */
+	int used[4];			/* Which of the surfaces are blended */
+	int direct;			/* Only the addresses need to be changed */
+	int programmed;			/* regs and addr_regs are set */
+	struct beu_regs regs;
+	uint32_t start_reg;
+	int addr_regs[4][3];		/* Y, C and alpha address registers, 0 if none */
+};
 
-	/* Set surface order */
-	write_reg(base_addr, bblcr0, BBLCR0);
+/* Can the hardware blend the surface as it is, in a single job? */
+static int is_direct(const struct shbeu_surface *spec)
+{
+	if (!spec)
+		return 1;
 
-	if (setup_src_surface(base_addr, 0, src1) < 0)
-		goto err;
-	if (setup_src_surface(base_addr, 1, src2) < 0)
-		goto err;
-	if (setup_src_surface(base_addr, 2, src3) < 0)
-		goto err;
-	if (setup_dst_surface(base_addr, dest) < 0)
-		goto err;
+	/* The palette is checked each time a job is queued, and converted
+	   formats are always bounced */
+	if (spec->s.format == REN_PAL8 || hw_format(spec->s.format) != spec->s.format)
+		return 0;
 
-	if (src2) {
-		if (different_colorspace(src1->s.format, src2->s.format)) {
-			uint32_t bsifr = read_reg(base_addr, BSIFR + SRC1_BASE);
-			debug_info("Setting BSIFR1 IN1TE bit");
-			bsifr  |= (BSIFR1_IN1TE | BSIFR1_IN1TM);
-			write_reg(base_addr, bsifr, BSIFR + SRC1_BASE);
-		}
+	return (is_aligned(spec) && !too_big(spec) &&
+		!(spec->s.pitch % 4) && spec->s.pitch <= BEU_MAX_SIZE);
+}
 
-		src_check = src2;
-	}
+/* Can the hardware access every plane of the surfaces without bounce
+   buffers? */
+static int plan_mapped(SHBEU *pvt, const struct shbeu_plan *plan,
+	const struct shbeu_surface *spec)
+{
+	int j, k;
 
-	/* Is input 1 colorspace (after the colorspace converter) RGB? */
-	if (is_rgb(src_check->s.format)) {
-		uint32_t bpkfr = read_reg(base_addr, BPKFR);
-		debug_info("Setting BPKFR RY bit");
-		bpkfr |= BPKFR_RY;
-		write_reg(base_addr, bpkfr, BPKFR);
-	}
+	for (k=0; k<4; k++) {
+		void *planes[3] = { spec[k].s.py, spec[k].s.pc, spec[k].s.pa };
 
-	/* Is the output colorspace different to input? */
-	if (different_colorspace(dest->s.format, src_check->s.format)) {
-		uint32_t bpkfr = read_reg(base_addr, BPKFR);
-		debug_info("Setting BPKFR TE bit");
-		bpkfr |= (BPKFR_TM2 | BPKFR_TM | BPKFR_DITH1 | BPKFR_TE);
-		write_reg(base_addr, bpkfr, BPKFR);
+		if (!plan->used[k])
+			continue;
+		for (j=0; j<3; j++) {
+			if (planes[j] && !plane_phys(pvt, &spec[k], planes[j], j))
+				return 0;
+		}
 	}
 
-	/* enable interrupt */
-	write_reg(base_addr, 1, BEIER);
+	return 1;
+}
 
-	/* start operation */
-	start_reg = BESTR_BEIVK;
-	if (src1) start_reg |= BESTR_CHON1;
-	if (src2) start_reg |= BESTR_CHON2;
-	if (src3) start_reg |= BESTR_CHON3;
-	write_reg(base_addr, start_reg, BESTR);
+/* Work out the registers of a plan from surfaces the hardware accesses
+   directly, so that they have the pitch and format given when the plan was
+   created. Only the addresses change when the plan is run. */
+static int plan_program(struct shbeu_plan *plan, struct shbeu_surface *spec)
+{
+	const int offsets[] = {SRC1_BASE, SRC2_BASE, SRC3_BASE};
+	const struct shbeu_surface *inputs[3];
+	int i, k;
+
+	memset(&plan->regs, 0, sizeof(plan->regs));
+	if (program_blend(plan->beu, &plan->regs, &spec[0],
+			plan->used[1] ? &spec[1] : NULL,
+			plan->used[2] ? &spec[2] : NULL, &spec[3],
+			NULL, 0, &plan->start_reg, inputs) < 0)
+		return -1;
 
-	debug_info("out");
+	memset(plan->addr_regs, 0, sizeof(plan->addr_regs));
+	for (i=0; i<3; i++) {
+		if (!inputs[i])
+			continue;
+		k = inputs[i] - spec;
+		plan->addr_regs[k][0] = offsets[i] + BSAYR;
+		if (spec[k].s.pc) plan->addr_regs[k][1] = offsets[i] + BSACR;
+		if (spec[k].s.pa) plan->addr_regs[k][2] = offsets[i] + BSAAR;
+	}
+	plan->addr_regs[3][0] = BDAYR;
+	if (spec[3].s.pc) plan->addr_regs[3][1] = BDACR;
 
+	plan->programmed = 1;
 	return 0;
-
-err:
-	debug_info("ERR: error detected");
-	uiomux_unlock(pvt->uiomux, pvt->uiores);
-	return -1;
 }
 
-void
-shbeu_wait(SHBEU *pvt)
+struct shbeu_plan *
+shbeu_plan_create(
+	SHBEU *pvt,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest)
 {
-	void *base_addr = pvt->uio_mmio.iomem;
+	const struct shbeu_surface *in[4] = { src1, src2, src3, dest };
+	struct shbeu_surface hw[4];
+	struct shbeu_surface spec[4];
+	struct shbeu_plan *plan;
+	int k, ret;
+
+	if (!pvt || check_blend(src1, NULL, 0, dest) < 0)
+		return NULL;
+
+	plan = calloc(1, sizeof(*plan));
+	if (!plan)
+		return NULL;
+
+	plan->beu = pvt;
+	for (k=0; k<4; k++) {
+		if (in[k]) {
+			plan->spec[k] = *in[k];
+			plan->used[k] = 1;
+		}
+	}
 
-	debug_info("in");
+	/* Anything else is blended by shbeu_submit() when the plan is run */
+	plan->direct = !pvt->cpu;
+	for (k=0; k<4; k++)
+		plan->direct &= is_direct(in[k]);
+	if (!plan->direct)
+		return plan;
+
+	/* The registers are worked out from the surfaces as they are, as
+	   bounce buffers would have a different layout. If the hardware cannot
+	   access them, the blend is only checked, and the registers are worked
+	   out when the plan is first run with surfaces it can access. */
+	memcpy(spec, plan->spec, sizeof(spec));
+	if (plan_mapped(pvt, plan, spec)) {
+		ret = plan_program(plan, spec);
+	} else {
+		struct beu_regs regs;
+		uint32_t start_reg;
 
-	uiomux_sleep(pvt->uiomux, pvt->uiores);
+		for (k=0; k<4; k++) {
+			if (in[k] && get_hw_surface(pvt, &hw[k], in[k]) < 0)
+				break;
+		}
+		ret = -1;
+		if (k == 4) {
+			memset(&regs, 0, sizeof(regs));
+			ret = program_blend(pvt, &regs, &hw[0],
+				src2 ? &hw[1] : NULL, src3 ? &hw[2] : NULL, &hw[3],
+				NULL, 0, &start_reg, NULL);
+		}
+		while (k-- > 0) {
+			if (in[k])
+				free_temp_buf(pvt, in[k], &hw[k]);
+		}
+	}
+	if (ret < 0) {
+		free(plan);
+		return NULL;
+	}
 
-	/* Acknowledge interrupt, write 0 to bit 0 */
-	write_reg(base_addr, 0x100, BEVTR);
+	return plan;
+}
 
-	/* Wait for BEU to stop */
-	while (read_reg(base_addr, BSTAR) & 1)
-		;
+/* The surfaces of a plan with new addresses */
+static void
+plan_surfaces(
+	const struct shbeu_plan *plan,
+	const struct shbeu_addrs *addrs,
+	struct shbeu_surface *spec)
+{
+	int k;
 
-	/* If we had to allocate hardware output buffer, copy the contents */
-	if (pvt->p_dest_user)
-		copy_surface(&pvt->p_dest_user->s, &pvt->dest_hw.s);
+	for (k=0; k<4; k++) {
+		spec[k] = plan->spec[k];
+		spec[k].s.py = addrs[k].py;
+		spec[k].s.pc = addrs[k].pc;
+		spec[k].s.pa = addrs[k].pa;
+	}
+}
 
-	/* Free any temporary hardware buffers */
-	if (pvt->p_dest_user)
-		free_temp_buf(pvt, &pvt->p_dest_user->s, &pvt->dest_hw.s);
-	if (pvt->p_src3_user)
-		free_temp_buf(pvt, &pvt->p_src3_user->s, &pvt->src3_hw.s);
-	if (pvt->p_src2_user)
-		free_temp_buf(pvt, &pvt->p_src2_user->s, &pvt->src2_hw.s);
-	if (pvt->p_src1_user)
-		free_temp_buf(pvt, &pvt->p_src1_user->s, &pvt->src1_hw.s);
+/* Run a plan as an ordinary blend */
+static int plan_submit(struct shbeu_plan *plan, const struct shbeu_addrs *addrs)
+{
+	struct shbeu_surface spec[4];
 
-	uiomux_unlock(pvt->uiomux, pvt->uiores);
+	plan_surfaces(plan, addrs, spec);
 
-	debug_info("out");
+	return shbeu_submit(plan->beu, &spec[0],
+		plan->used[1] ? &spec[1] : NULL,
+		plan->used[2] ? &spec[2] : NULL,
+		&spec[3], NULL, NULL);
 }
 
-
 int
-shbeu_blend(
-	SHBEU *pvt,
-	const struct shbeu_surface *src1,
-	const struct shbeu_surface *src2,
-	const struct shbeu_surface *src3,
-	const struct shbeu_surface *dest)
+shbeu_plan_run(struct shbeu_plan *plan, const struct shbeu_addrs *addrs)
 {
-	int ret = 0;
+	struct shbeu_surface spec[4];
+	struct beu_regs regs;
+	struct beu_job *job;
+	SHBEU *pvt;
+	int j, k;
 
-	ret = shbeu_start_blend(pvt, src1, src2, src3, dest);
+	if (!plan || !addrs)
+		return -1;
 
-	if (ret == 0)
-		shbeu_wait(pvt);
+	if (!plan->direct)
+		return plan_submit(plan, addrs);
 
-	return ret;
+	pvt = plan->beu;
+	plan_surfaces(plan, addrs, spec);
+
+	/* The first surfaces the hardware can access set the registers */
+	if (!plan->programmed) {
+		if (!plan_mapped(pvt, plan, spec))
+			return plan_submit(plan, addrs);
+		if (plan_program(plan, spec) < 0)
+			return -1;
+		plan_surfaces(plan, addrs, spec);
+	}
+
+	regs = plan->regs;
+	for (k=0; k<4; k++) {
+		void *planes[3] = { addrs[k].py, addrs[k].pc, addrs[k].pa };
+
+		for (j=0; j<3; j++) {
+			unsigned long phys;
+
+			if (!plan->addr_regs[k][j])
+				continue;
+
+			/* Buffers the hardware cannot access need bounce buffers */
+			phys = plane_phys(pvt, &plan->spec[k], planes[j], j);
+			if (!phys)
+				return plan_submit(plan, addrs);
+
+			set_reg(&regs, phys, plan->addr_regs[k][j]);
+		}
+	}
+
+	/* Both register planes are in use, wait for the oldest job */
+	if (pvt->nr_jobs == BEU_NR_JOBS && complete_job(pvt) < 0)
+		return -ETIMEDOUT;
+
+	/* The surfaces are only kept so that the job can be resubmitted, the
+	   hardware uses them directly */
+	job = &pvt->jobs[(pvt->job_head + pvt->nr_jobs) % BEU_NR_JOBS];
+	job->src1_user = job->src1_hw = spec[0];
+	job->src2_user = job->src2_hw = spec[1];
+	job->src3_user = job->src3_hw = spec[2];
+	job->dest_user = job->dest_hw = spec[3];
+	job->p_src1_user = &job->src1_user;
+	job->p_src2_user = plan->used[1] ? &job->src2_user : NULL;
+	job->p_src3_user = plan->used[2] ? &job->src3_user : NULL;
+	job->p_dest_user = &job->dest_user;
+	job->nr_windows = 0;
+	job->partial = 0;
+	job->fixup.nr_rects = 0;
+	job->fixup.fill = 0;
+	job->uses_clut = 0;
+	job->owned = NULL;
+	job->done = NULL;
+	job->done_data = NULL;
+	job->start_reg = plan->start_reg;
+
+	queue_job(pvt, job, &regs);
+
+	return 0;
+}
+
+void
+shbeu_plan_destroy(struct shbeu_plan *plan)
+{
+	free(plan);
 }
@@ -0,0 +1,271 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Buffers are grouped into size classes so that frames of a similar size can
+ * share buffers. Each power of two is split into 4 classes, which means that
+ * at most 25% of a buffer is wasted.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "bounce.h"
+
+#define BOUNCE_MIN_SIZE 4096
+#define BOUNCE_ALIGN    32
+
+static size_t class_size(size_t len)
+{
+	size_t p = BOUNCE_MIN_SIZE;
+	size_t step;
+
+	if (len <= BOUNCE_MIN_SIZE)
+		return BOUNCE_MIN_SIZE;
+
+	while (p <= len / 2)
+		p <<= 1;
+
+	step = p / 4;
+	if (step < BOUNCE_MIN_SIZE)
+		step = BOUNCE_MIN_SIZE;
+
+	return (len + step - 1) & ~(step - 1);
+}
+
+static struct bounce_class *find_class(struct bounce_pool *pool, size_t size, int create)
+{
+	struct bounce_class *c;
+	int i;
+
+	for (i=0; i<pool->nr_classes; i++) {
+		if (pool->classes[i].size == size)
+			return &pool->classes[i];
+	}
+
+	if (!create)
+		return NULL;
+
+	/* Reuse a class that is no longer holding any buffers */
+	for (i=0; i<pool->nr_classes; i++) {
+		if (pool->classes[i].nr_free == 0) {
+			pool->classes[i].size = size;
+			return &pool->classes[i];
+		}
+	}
+
+	if (pool->nr_classes >= BOUNCE_NR_CLASSES)
+		return NULL;
+
+	c = &pool->classes[pool->nr_classes++];
+	c->size = size;
+	c->nr_free = 0;
+	return c;
+}
+
+static int can_cache(struct bounce_pool *pool, struct bounce_class *c)
+{
+	if (!c || c->nr_free >= pool->max_per_class)
+		return 0;
+	if (pool->max_bytes && (pool->cached_bytes + c->size > pool->max_bytes))
+		return 0;
+	return 1;
+}
+
+static void push(struct bounce_pool *pool, struct bounce_class *c, void *buf)
+{
+	c->free[c->nr_free++] = buf;
+	pool->cached_bytes += c->size;
+}
+
+/* Free cached buffers until the pool is within its limits */
+static void trim(struct bounce_pool *pool)
+{
+	int i;
+
+	for (i=0; i<pool->nr_classes; i++) {
+		struct bounce_class *c = &pool->classes[i];
+
+		while (c->nr_free > 0 &&
+		       (c->nr_free > pool->max_per_class ||
+		        (pool->max_bytes && pool->cached_bytes > pool->max_bytes))) {
+			c->nr_free--;
+			uiomux_free(pool->uiomux, pool->uiores, c->free[c->nr_free], c->size);
+			pool->cached_bytes -= c->size;
+		}
+	}
+}
+
+void bounce_init(struct bounce_pool *pool, UIOMux *uiomux, uiomux_resource_t uiores)
+{
+	memset(pool, 0, sizeof(*pool));
+	pthread_mutex_init(&pool->lock, NULL);
+	pool->uiomux = uiomux;
+	pool->uiores = uiores;
+	pool->max_per_class = BOUNCE_DEF_PER_CLASS;
+	pool->max_bytes = BOUNCE_DEF_MAX_BYTES;
+}
+
+static void drain(struct bounce_pool *pool)
+{
+	int i;
+
+	for (i=0; i<pool->nr_classes; i++) {
+		struct bounce_class *c = &pool->classes[i];
+
+		while (c->nr_free > 0) {
+			c->nr_free--;
+			uiomux_free(pool->uiomux, pool->uiores, c->free[c->nr_free], c->size);
+		}
+	}
+	pool->cached_bytes = 0;
+	pool->nr_classes = 0;
+}
+
+void bounce_drain(struct bounce_pool *pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	drain(pool);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+void bounce_exit(struct bounce_pool *pool)
+{
+	bounce_drain(pool);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+int bounce_set_limits(struct bounce_pool *pool, int max_per_class, size_t max_bytes)
+{
+	if (max_per_class < 0 || max_per_class > BOUNCE_MAX_PER_CLASS)
+		return -1;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->max_per_class = max_per_class;
+	pool->max_bytes = max_bytes;
+	trim(pool);
+	pthread_mutex_unlock(&pool->lock);
+
+	return 0;
+}
+
+void *bounce_get(struct bounce_pool *pool, size_t len)
+{
+	size_t size = class_size(len);
+	struct bounce_class *c;
+	void *buf;
+
+	pthread_mutex_lock(&pool->lock);
+
+	c = find_class(pool, size, 0);
+	if (c && c->nr_free > 0) {
+		c->nr_free--;
+		pool->cached_bytes -= size;
+		buf = c->free[c->nr_free];
+		pthread_mutex_unlock(&pool->lock);
+		return buf;
+	}
+
+	buf = uiomux_malloc(pool->uiomux, pool->uiores, size, BOUNCE_ALIGN);
+	if (!buf && pool->cached_bytes) {
+		/* Cached buffers of other sizes may be in the way */
+		drain(pool);
+		buf = uiomux_malloc(pool->uiomux, pool->uiores, size, BOUNCE_ALIGN);
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return buf;
+}
+
+void bounce_put(struct bounce_pool *pool, void *buf, size_t len)
+{
+	size_t size = class_size(len);
+	struct bounce_class *c;
+
+	if (!buf)
+		return;
+
+	pthread_mutex_lock(&pool->lock);
+	c = find_class(pool, size, 1);
+	if (can_cache(pool, c))
+		push(pool, c, buf);
+	else
+		uiomux_free(pool->uiomux, pool->uiores, buf, size);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+int bounce_prealloc(struct bounce_pool *pool, const size_t *lens, int nr_lens, int count)
+{
+	struct bounce_class *c;
+	size_t size;
+	void *buf;
+	int i, j, nr, ret = 0;
+
+	pthread_mutex_lock(&pool->lock);
+
+	for (i=0; ret == 0 && i<nr_lens; i++) {
+		size = class_size(lens[i]);
+
+		/* Each class is filled once, for all of its buffers */
+		for (j=0; j<i; j++) {
+			if (class_size(lens[j]) == size)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		nr = 0;
+		for (j=i; j<nr_lens; j++) {
+			if (class_size(lens[j]) == size)
+				nr += count;
+		}
+
+		c = find_class(pool, size, 1);
+		if (!c || c->nr_free + nr > pool->max_per_class) {
+			ret = -1;
+			break;
+		}
+
+		for (; nr > 0; nr--) {
+			if (!can_cache(pool, c)) {
+				ret = -1;
+				break;
+			}
+
+			buf = uiomux_malloc(pool->uiomux, pool->uiores, size, BOUNCE_ALIGN);
+			if (!buf) {
+				ret = -1;
+				break;
+			}
+			push(pool, c, buf);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret;
+}
@@ -0,0 +1,81 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Pool of hardware accessible buffers used to bounce user surfaces */
+#ifndef __BOUNCE_H__
+#define __BOUNCE_H__
+
+#include <stddef.h>
+#include <pthread.h>
+#include <uiomux/uiomux.h>
+
+#define BOUNCE_NR_CLASSES	16
+
+/* The jobs in flight can hold up to (BEU_NR_JOBS + BEU_NR_TASKS) *
+   BEU_BOUNCE_PER_JOB buffers, which may all be in one class, see
+   shbeu_private.h */
+#define BOUNCE_MAX_PER_CLASS	144
+
+/* Defaults, see shbeu_set_bounce_limits() */
+#define BOUNCE_DEF_PER_CLASS	BOUNCE_MAX_PER_CLASS
+#define BOUNCE_DEF_MAX_BYTES	0	/* No limit */
+
+struct bounce_class {
+	size_t size;		/* Size of every buffer in this class */
+	int nr_free;
+	void *free[BOUNCE_MAX_PER_CLASS];
+};
+
+/* Buffers are returned by the copy-back thread, so the pool is locked */
+struct bounce_pool {
+	pthread_mutex_t lock;
+	UIOMux *uiomux;
+	uiomux_resource_t uiores;
+	int max_per_class;	/* High-water mark for each size class */
+	size_t max_bytes;	/* High-water mark for all cached buffers, 0=no limit */
+	size_t cached_bytes;	/* Bytes currently held in free lists */
+	int nr_classes;
+	struct bounce_class classes[BOUNCE_NR_CLASSES];
+};
+
+void bounce_init(struct bounce_pool *pool, UIOMux *uiomux, uiomux_resource_t uiores);
+
+/* Release all cached buffers back to uiomux */
+void bounce_drain(struct bounce_pool *pool);
+
+/* Release all cached buffers, the pool cannot be used again */
+void bounce_exit(struct bounce_pool *pool);
+
+int bounce_set_limits(struct bounce_pool *pool, int max_per_class, size_t max_bytes);
+
+/* Get a buffer of at least len bytes */
+void *bounce_get(struct bounce_pool *pool, size_t len);
+
+/* Return a buffer obtained with bounce_get(), len must be the same */
+void bounce_put(struct bounce_pool *pool, void *buf, size_t len);
+
+/* Add count buffers to the pool for each of the nr_lens buffers of lens[i]
+   bytes, so buffers in the same size class get count buffers each */
+int bounce_prealloc(struct bounce_pool *pool, const size_t *lens, int nr_lens, int count);
+
+#endif /* __BOUNCE_H__ */
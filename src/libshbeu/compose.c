@@ -0,0 +1,193 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Composition of any number of layers.
+ *
+ * Each hardware pass blends up to 3 inputs. The first pass blends the base
+ * layer with the next two layers, and each following pass blends the result
+ * of the previous pass with the next two layers. Only one input per pass can
+ * be colorspace converted, but with two colorspaces, one of them is always
+ * shared by at least two of the three inputs.
+ *
+ * Results are written to one of two intermediate buffers in turn, and the
+ * last pass writes to the destination. The intermediate buffers use the
+ * colorspace of the layers in the pass that reads them, so the converter is
+ * not needed for them. Passes are queued back to back on the hardware.
+ *
+ * Layers that cannot be seen are not blended, and a layer that is opaque
+ * and covers the whole output becomes the base, so that the layers below it
+ * are not blended. These are dropped by cull_layers(), as for single blends.
+ * Layers only partly hidden by opaque layers above them are still blended
+ * over the whole output, as each pass covers the whole output.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "shbeu_private.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define debug_info(s) fprintf(stderr, "%s: %s\n", __func__, s)
+#else
+#define debug_info(s)
+#endif
+
+struct inter_buf {
+	struct shbeu_surface spec;
+	size_t len;
+};
+
+/* Get a hardware accessible buffer for the output of a pass. It is big
+   enough for either colorspace, see set_inter_format(). */
+static int get_inter_buf(SHBEU *pvt, struct inter_buf *buf, int w, int h)
+{
+	memset(buf, 0, sizeof(*buf));
+	buf->spec.alpha = 255;
+	buf->spec.s.w = w;
+	buf->spec.s.h = h;
+	buf->spec.s.pitch = w;
+	buf->len = size_y(REN_RGB32, w * h);
+
+	if (pvt->cpu)
+		buf->spec.s.py = malloc(buf->len);
+	else
+		buf->spec.s.py = bounce_get(&pvt->bounce, buf->len);
+	if (!buf->spec.s.py)
+		return -1;
+
+	return 0;
+}
+
+static void set_inter_format(struct inter_buf *buf, int ycbcr)
+{
+	struct ren_vid_surface *s = &buf->spec.s;
+
+	/* 4:2:2 is used so that chroma is not lost between passes */
+	s->format = ycbcr ? REN_NV16 : REN_RGB32;
+	s->pc = ycbcr ? s->py + size_y(s->format, s->w * s->h) : NULL;
+}
+
+static void put_inter_buf(SHBEU *pvt, struct inter_buf *buf)
+{
+	if (!buf->spec.s.py)
+		return;
+
+	if (pvt->cpu)
+		free(buf->spec.s.py);
+	else
+		bounce_put(&pvt->bounce, buf->spec.s.py, buf->len);
+	buf->spec.s.py = NULL;
+}
+
+int
+shbeu_compose(
+	SHBEU *pvt,
+	const struct shbeu_surface *layers,
+	int nr_layers,
+	const struct shbeu_surface *dest)
+{
+	const struct shbeu_surface **visible;
+	struct shbeu_surface base;
+	struct inter_buf inter[2];
+	const struct shbeu_surface *cur;
+	int w, h, nr_visible, i, pass;
+	int ret = -1;
+
+	if (!pvt || !layers || nr_layers < 1 || !dest) {
+		debug_info("ERR: Invalid input - need at least 1 layer and dest");
+		return -1;
+	}
+
+	w = layers[0].s.w;
+	h = layers[0].s.h;
+
+	visible = malloc(nr_layers * sizeof(*visible));
+	if (!visible)
+		return -1;
+	memset(inter, 0, sizeof(inter));
+
+	/* The base is the topmost layer that hides everything below it */
+	for (i=0; i<nr_layers; i++)
+		visible[i] = &layers[i];
+	nr_visible = cull_layers(pvt, visible, nr_layers, &base) - 1;
+
+#ifdef DEBUG
+	fprintf(stderr, "compose: %d layers, %d blended over the base\n", nr_layers, nr_visible);
+#endif
+
+	cur = visible[0];
+	if (nr_visible == 0) {
+		/* Only the base is needed, so this is a plain copy or conversion */
+		if (shbeu_submit(pvt, cur, NULL, NULL, dest, NULL, NULL) < 0)
+			goto out;
+	}
+
+	for (i=1, pass=0; i<=nr_visible; pass++) {
+		const struct shbeu_surface *ovl1 = visible[i++];
+		const struct shbeu_surface *ovl2 = (i <= nr_visible) ? visible[i++] : NULL;
+		const struct shbeu_surface *out = dest;
+
+		if (i <= nr_visible) {
+			/* Not the last pass, output in the colorspace of the next */
+			struct inter_buf *buf = &inter[pass & 1];
+
+			if (!buf->spec.s.py && get_inter_buf(pvt, buf, w, h) < 0) {
+				debug_info("ERR: Could not allocate intermediate buffer");
+				goto out;
+			}
+			set_inter_format(buf, is_ycbcr(visible[i]->s.format));
+			out = &buf->spec;
+		}
+
+		if (shbeu_submit(pvt, cur, ovl1, ovl2, out, NULL, NULL) < 0)
+			goto out;
+
+		cur = out;
+	}
+
+	ret = 0;
+
+out:
+	/* The queued passes read the intermediate buffers, so they must have
+	   finished, or been dropped, before the buffers are released */
+	if (flush_blends(pvt) < 0) {
+		debug_info("ERR: Composition did not complete");
+		ret = -1;
+		while (pvt->nr_jobs)
+			shbeu_wait_timeout(pvt, pvt->timeout_ms, 0);
+	}
+	put_inter_buf(pvt, &inter[0]);
+	put_inter_buf(pvt, &inter[1]);
+	free(visible);
+
+	return ret;
+}
@@ -0,0 +1,627 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Copy engine for bounce buffers.
+ *
+ * Planes without gaps between rows are copied as a single block. Large
+ * copies are split into units of about the chunk size, which are shared
+ * between the thread that asked for the copy and a few helper threads, so
+ * the planes of all surfaces of a blend are copied at the same time.
+ *
+ * Large rows are written with non-temporal stores where the CPU has them,
+ * which are SSE2 on x86 and STNP on AArch64.
+ * The destination is usually a bounce buffer or a frame buffer that is not
+ * read back by the CPU, so there is no point in filling the cache with it.
+ *
+ * Formats the hardware cannot read are converted as they are copied, so
+ * the source is only read once: packed 4:2:2 is split into luma and chroma
+ * planes, and the chroma bytes of NV21 are swapped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_SIMD
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#include "copy.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define debug_info(s) fprintf(stderr, "%s: %s\n", __func__, s)
+#else
+#define debug_info(s)
+#endif
+
+/* Rows shorter than this are left to memcpy */
+#define STREAM_MIN 4096
+
+typedef void (*copy_row_fn)(void *dst, const void *src, size_t len);
+typedef void (*split_row_fn)(void *even, void *odd, const void *src, size_t len);
+
+static void copy_row_c(void *dst, const void *src, size_t len)
+{
+	memcpy(dst, src, len);
+}
+
+static void split_row_c(void *even, void *odd, const void *src, size_t len)
+{
+	uint8_t *e = even;
+	uint8_t *o = odd;
+	const uint8_t *s = src;
+	size_t i;
+
+	for (i=0; i<len/2; i++) {
+		e[i] = s[2*i];
+		o[i] = s[2*i + 1];
+	}
+}
+
+static void swap_row_c(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t i;
+
+	for (i=0; i+1<len; i+=2) {
+		uint8_t t = s[i];
+		d[i] = s[i + 1];
+		d[i + 1] = t;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static void copy_row_sse2(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+	size_t head;
+
+	if (len < STREAM_MIN) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	/* Streaming stores must be aligned */
+	head = (16 - ((uintptr_t)d & 15)) & 15;
+	memcpy(d, s, head);
+	d += head;
+	s += head;
+	len -= head;
+
+	for (; len >= 64; len -= 64, s += 64, d += 64) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i c = _mm_loadu_si128((const __m128i *)(s + 32));
+		__m128i e = _mm_loadu_si128((const __m128i *)(s + 48));
+		_mm_stream_si128((__m128i *)d, a);
+		_mm_stream_si128((__m128i *)(d + 16), b);
+		_mm_stream_si128((__m128i *)(d + 32), c);
+		_mm_stream_si128((__m128i *)(d + 48), e);
+	}
+	memcpy(d, s, len);
+
+	/* Make the stores visible to other threads and the hardware */
+	_mm_sfence();
+}
+
+__attribute__((target("sse2")))
+static void split_row_sse2(void *even, void *odd, const void *src, size_t len)
+{
+	uint8_t *e = even;
+	uint8_t *o = odd;
+	const uint8_t *s = src;
+	const __m128i mask = _mm_set1_epi16(0x00FF);
+
+	for (; len >= 32; len -= 32, s += 32, e += 16, o += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		__m128i b = _mm_loadu_si128((const __m128i *)(s + 16));
+		__m128i ev = _mm_packus_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+		__m128i od = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i *)e, ev);
+		_mm_storeu_si128((__m128i *)o, od);
+	}
+	split_row_c(e, o, s, len);
+}
+
+__attribute__((target("sse2")))
+static void swap_row_sse2(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	for (; len >= 16; len -= 16, s += 16, d += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i *)s);
+		a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+		_mm_storeu_si128((__m128i *)d, a);
+	}
+	swap_row_c(d, s, len);
+}
+#endif
+
+#ifdef HAVE_NEON_SIMD
+/* Whole cache lines, so that write combining buffers are filled at once.
+   Only AArch64 has non-temporal stores, 32-bit ARM uses ordinary ones. */
+static void copy_row_neon(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	if (len < STREAM_MIN) {
+		memcpy(dst, src, len);
+		return;
+	}
+
+	for (; len >= 64; len -= 64, s += 64, d += 64) {
+		uint8x16_t a = vld1q_u8(s);
+		uint8x16_t b = vld1q_u8(s + 16);
+		uint8x16_t c = vld1q_u8(s + 32);
+		uint8x16_t e = vld1q_u8(s + 48);
+#ifdef __aarch64__
+		__asm__ volatile(
+			"stnp %q1, %q2, [%0]\n\t"
+			"stnp %q3, %q4, [%0, #32]"
+			: : "r"(d), "w"(a), "w"(b), "w"(c), "w"(e) : "memory");
+#else
+		vst1q_u8(d, a);
+		vst1q_u8(d + 16, b);
+		vst1q_u8(d + 32, c);
+		vst1q_u8(d + 48, e);
+#endif
+	}
+	memcpy(d, s, len);
+
+#ifdef __aarch64__
+	/* Make the stores visible to other threads and the hardware */
+	__asm__ volatile("dmb oshst" : : : "memory");
+#endif
+}
+
+static void split_row_neon(void *even, void *odd, const void *src, size_t len)
+{
+	uint8_t *e = even;
+	uint8_t *o = odd;
+	const uint8_t *s = src;
+
+	for (; len >= 32; len -= 32, s += 32, e += 16, o += 16) {
+		uint8x16x2_t v = vld2q_u8(s);
+		vst1q_u8(e, v.val[0]);
+		vst1q_u8(o, v.val[1]);
+	}
+	split_row_c(e, o, s, len);
+}
+
+static void swap_row_neon(void *dst, const void *src, size_t len)
+{
+	uint8_t *d = dst;
+	const uint8_t *s = src;
+
+	for (; len >= 16; len -= 16, s += 16, d += 16)
+		vst1q_u8(d, vrev16q_u8(vld1q_u8(s)));
+	swap_row_c(d, s, len);
+}
+#endif
+
+static copy_row_fn copy_row = copy_row_c;
+static split_row_fn split_row = split_row_c;
+static copy_row_fn swap_row = swap_row_c;
+
+static int default_threads(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* The calling thread also copies */
+	if (cpus <= 1)
+		return 0;
+	return (cpus - 1 < COPY_MAX_THREADS) ? cpus - 1 : COPY_MAX_THREADS;
+}
+
+/* The kernels are shared by all engines, so they are only selected once */
+static void select_kernels(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2")) {
+		copy_row = copy_row_sse2;
+		split_row = split_row_sse2;
+		swap_row = swap_row_sse2;
+		debug_info("Using SSE2");
+	}
+#endif
+#ifdef HAVE_NEON_SIMD
+#if defined(__aarch64__)
+	copy_row = copy_row_neon;
+	split_row = split_row_neon;
+	swap_row = swap_row_neon;
+#else
+	if (getauxval(AT_HWCAP) & HWCAP_NEON) {
+		copy_row = copy_row_neon;
+		split_row = split_row_neon;
+		swap_row = swap_row_neon;
+	}
+#endif
+	debug_info("Using NEON");
+#endif
+}
+
+void copy_init(struct copy_engine *engine)
+{
+	static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+	memset(engine, 0, sizeof(*engine));
+	pthread_mutex_init(&engine->lock, NULL);
+	pthread_cond_init(&engine->work_cond, NULL);
+	pthread_cond_init(&engine->done_cond, NULL);
+	engine->max_threads = default_threads();
+	engine->chunk = COPY_DEF_CHUNK;
+
+	pthread_once(&kernels_once, select_kernels);
+}
+
+/* Units already taken are finished by the threads that took them, the rest
+   by the threads waiting for them. No threads are started while they are
+   being stopped, see start_threads(). */
+static void stop_threads(struct copy_engine *engine)
+{
+	int i, nr;
+
+	pthread_mutex_lock(&engine->lock);
+
+	/* Only one caller stops the threads, the others wait for it */
+	if (engine->quit) {
+		while (engine->quit)
+			pthread_cond_wait(&engine->done_cond, &engine->lock);
+		pthread_mutex_unlock(&engine->lock);
+		return;
+	}
+
+	engine->quit = 1;
+	nr = engine->nr_threads;
+	pthread_cond_broadcast(&engine->work_cond);
+	pthread_mutex_unlock(&engine->lock);
+
+	for (i=0; i<nr; i++)
+		pthread_join(engine->threads[i], NULL);
+
+	pthread_mutex_lock(&engine->lock);
+	engine->nr_threads = 0;
+	engine->quit = 0;
+	pthread_cond_broadcast(&engine->done_cond);
+	pthread_mutex_unlock(&engine->lock);
+}
+
+void copy_exit(struct copy_engine *engine)
+{
+	stop_threads(engine);
+	pthread_cond_destroy(&engine->done_cond);
+	pthread_cond_destroy(&engine->work_cond);
+	pthread_mutex_destroy(&engine->lock);
+}
+
+int copy_set_threads(struct copy_engine *engine, int nr_threads, size_t chunk)
+{
+	if (nr_threads < 0 || nr_threads > COPY_MAX_THREADS)
+		return -1;
+
+	/* Threads are started again when they are next needed */
+	stop_threads(engine);
+
+	pthread_mutex_lock(&engine->lock);
+	engine->max_threads = nr_threads;
+	engine->chunk = chunk ? chunk : COPY_DEF_CHUNK;
+	pthread_mutex_unlock(&engine->lock);
+
+	return 0;
+}
+
+void copy_batch_init(struct copy_batch *batch)
+{
+	batch->nr_planes = 0;
+	batch->overflow = 0;
+}
+
+static void add_plane(
+	struct copy_batch *batch,
+	enum copy_op op,
+	void *dst,
+	void *dst2,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride)
+{
+	struct copy_plane *p;
+	size_t dst_row = (op == COPY_SPLIT) ? row_bytes / 2 : row_bytes;
+
+	if (!src || !dst || rows <= 0 || row_bytes == 0)
+		return;
+	if (batch->nr_planes == COPY_MAX_PLANES) {
+		debug_info("ERR: Too many planes to copy");
+		batch->overflow = 1;
+		return;
+	}
+
+	p = &batch->planes[batch->nr_planes++];
+	p->op = op;
+	p->dst = dst;
+	p->dst2 = dst2;
+	p->src = src;
+	p->row_bytes = row_bytes;
+	p->rows = rows;
+	p->dst_stride = dst_stride;
+	p->src_stride = src_stride;
+
+	/* No gaps between rows, so it can be copied in one go */
+	if (dst_row == dst_stride && row_bytes == src_stride) {
+		p->row_bytes = row_bytes * rows;
+		p->rows = 1;
+	}
+}
+
+void copy_add(
+	struct copy_batch *batch,
+	void *dst,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride)
+{
+	if (src == dst)
+		return;
+	add_plane(batch, COPY_PLAIN, dst, NULL, src, row_bytes, rows, dst_stride, src_stride);
+}
+
+void copy_add_split(
+	struct copy_batch *batch,
+	void *dst_even,
+	void *dst_odd,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride)
+{
+	if (!dst_odd)
+		return;
+	add_plane(batch, COPY_SPLIT, dst_even, dst_odd, src, row_bytes, rows, dst_stride, src_stride);
+}
+
+void copy_add_swap16(
+	struct copy_batch *batch,
+	void *dst,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride)
+{
+	add_plane(batch, COPY_SWAP16, dst, NULL, src, row_bytes, rows, dst_stride, src_stride);
+}
+
+/* Split the planes of a batch into units of about chunk bytes */
+static int split_batch(struct copy_batch *batch, size_t chunk)
+{
+	int i, nr = 0;
+
+	/* Splits and swaps work on pairs of bytes */
+	chunk = (chunk + 1) & ~(size_t)1;
+
+	for (i=0; i<batch->nr_planes; i++) {
+		struct copy_plane *p = &batch->planes[i];
+
+		if (p->rows == 1) {
+			p->unit_rows = 0;
+			p->nr_units = (p->row_bytes + chunk - 1) / chunk;
+		} else {
+			p->unit_rows = (p->row_bytes < chunk) ? chunk / p->row_bytes : 1;
+			p->nr_units = (p->rows + p->unit_rows - 1) / p->unit_rows;
+		}
+		nr += p->nr_units;
+	}
+
+	batch->chunk = chunk;
+	batch->next_plane = 0;
+	batch->next_unit = 0;
+	batch->remaining = nr;
+
+	return nr;
+}
+
+/* Copy len bytes of the source from src_off. Splits halve the offset of
+   the destinations. */
+static void copy_part(const struct copy_plane *p, size_t dst_off, size_t src_off, size_t len)
+{
+	const uint8_t *src = p->src;
+	uint8_t *dst = p->dst;
+	uint8_t *dst2 = p->dst2;
+
+	switch (p->op) {
+	case COPY_SPLIT:
+		split_row(dst + dst_off, dst2 + dst_off, src + src_off, len);
+		break;
+	case COPY_SWAP16:
+		swap_row(dst + dst_off, src + src_off, len);
+		break;
+	default:
+		copy_row(dst + dst_off, src + src_off, len);
+		break;
+	}
+}
+
+static void copy_unit(const struct copy_batch *batch, const struct copy_plane *p, int unit)
+{
+	size_t off;
+	int y, y2;
+
+	if (!p->unit_rows) {
+		off = unit * batch->chunk;
+		copy_part(p, (p->op == COPY_SPLIT) ? off / 2 : off, off,
+			(p->row_bytes - off < batch->chunk) ? p->row_bytes - off : batch->chunk);
+		return;
+	}
+
+	y = unit * p->unit_rows;
+	y2 = (y + p->unit_rows < p->rows) ? y + p->unit_rows : p->rows;
+	for (; y<y2; y++)
+		copy_part(p, y * p->dst_stride, y * p->src_stride, p->row_bytes);
+}
+
+/* Take the next unit of a batch. Must be called with the lock held. */
+static int claim_unit(struct copy_batch *batch, struct copy_plane **plane, int *unit)
+{
+	if (batch->next_plane == batch->nr_planes)
+		return 0;
+
+	*plane = &batch->planes[batch->next_plane];
+	*unit = batch->next_unit++;
+	if (batch->next_unit == (*plane)->nr_units) {
+		batch->next_plane++;
+		batch->next_unit = 0;
+	}
+
+	return 1;
+}
+
+/* Must be called with the lock held */
+static void unit_done(struct copy_engine *engine, struct copy_batch *batch)
+{
+	if (--batch->remaining == 0)
+		pthread_cond_broadcast(&engine->done_cond);
+}
+
+static void *copy_thread(void *arg)
+{
+	struct copy_engine *engine = arg;
+	struct copy_batch *batch;
+	struct copy_plane *plane;
+	int unit;
+
+	pthread_mutex_lock(&engine->lock);
+	while (!engine->quit) {
+		for (batch=engine->queue; batch; batch=batch->next) {
+			if (claim_unit(batch, &plane, &unit))
+				break;
+		}
+		if (!batch) {
+			pthread_cond_wait(&engine->work_cond, &engine->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&engine->lock);
+		copy_unit(batch, plane, unit);
+		pthread_mutex_lock(&engine->lock);
+
+		unit_done(engine, batch);
+	}
+	pthread_mutex_unlock(&engine->lock);
+
+	return NULL;
+}
+
+/* Must be called with the lock held. Threads that are being stopped are
+   not replaced until they have all been joined. */
+static void start_threads(struct copy_engine *engine)
+{
+	if (engine->quit)
+		return;
+
+	while (engine->nr_threads < engine->max_threads) {
+		if (pthread_create(&engine->threads[engine->nr_threads], NULL, copy_thread, engine) != 0) {
+			debug_info("ERR: Could not start a copy thread");
+			break;
+		}
+		engine->nr_threads++;
+	}
+}
+
+int copy_run(struct copy_engine *engine, struct copy_batch *batch)
+{
+	struct copy_batch **link;
+	struct copy_plane *plane;
+	int i, unit;
+
+	/* Nothing is copied rather than only some of the planes */
+	if (batch->overflow)
+		return -1;
+
+	pthread_mutex_lock(&engine->lock);
+
+	/* Not worth waking other threads for */
+	if (split_batch(batch, engine->chunk) <= 1 || !engine->max_threads) {
+		pthread_mutex_unlock(&engine->lock);
+		for (i=0; i<batch->nr_planes; i++) {
+			for (unit=0; unit<batch->planes[i].nr_units; unit++)
+				copy_unit(batch, &batch->planes[i], unit);
+		}
+		return 0;
+	}
+
+	start_threads(engine);
+
+	batch->next = NULL;
+	for (link=&engine->queue; *link; link=&(*link)->next)
+		;
+	*link = batch;
+	pthread_cond_broadcast(&engine->work_cond);
+
+	while (claim_unit(batch, &plane, &unit)) {
+		pthread_mutex_unlock(&engine->lock);
+		copy_unit(batch, plane, unit);
+		pthread_mutex_lock(&engine->lock);
+		unit_done(engine, batch);
+	}
+
+	while (batch->remaining)
+		pthread_cond_wait(&engine->done_cond, &engine->lock);
+
+	for (link=&engine->queue; *link != batch; link=&(*link)->next)
+		;
+	*link = batch->next;
+
+	pthread_mutex_unlock(&engine->lock);
+
+	return 0;
+}
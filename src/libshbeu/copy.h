@@ -0,0 +1,135 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Copies between user surfaces and bounce buffers */
+#ifndef __COPY_H__
+#define __COPY_H__
+
+#include <stddef.h>
+#include <pthread.h>
+
+#define COPY_MAX_THREADS	4
+#define COPY_MAX_PLANES		24	/* 3 planes for each of 3 surfaces and 4 windows */
+
+/* Default size of the pieces a copy is split into */
+#define COPY_DEF_CHUNK		(256 * 1024)
+
+/* What is done to each row */
+enum copy_op {
+	COPY_PLAIN,
+	COPY_SPLIT,	/* Even bytes to dst, odd bytes to dst2 */
+	COPY_SWAP16,	/* Swap the bytes of each 16-bit word */
+};
+
+/* A 2D copy. A plane with no gaps between rows is a single row. The sizes
+   are those of the source, for COPY_SPLIT each destination gets half. */
+struct copy_plane {
+	enum copy_op op;
+	void *dst;
+	void *dst2;
+	const void *src;
+	size_t row_bytes;
+	int rows;
+	size_t dst_stride;
+	size_t src_stride;
+	int unit_rows;		/* Rows in each unit, 0 if the row is split */
+	int nr_units;
+};
+
+/* Planes that are copied together. The planes are split into units, which
+   are copied by the calling thread and the helper threads. */
+struct copy_batch {
+	struct copy_plane planes[COPY_MAX_PLANES];
+	int nr_planes;
+	int overflow;		/* More than COPY_MAX_PLANES were added */
+	size_t chunk;
+	int next_plane;		/* Next unit to be copied */
+	int next_unit;
+	int remaining;		/* Units not yet copied */
+	struct copy_batch *next;
+};
+
+struct copy_engine {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	/* A batch has been queued */
+	pthread_cond_t done_cond;	/* A batch has been copied, or the threads stopped */
+	pthread_t threads[COPY_MAX_THREADS];
+	int nr_threads;		/* Helper threads running */
+	int max_threads;	/* Helper threads to start when needed */
+	size_t chunk;
+	struct copy_batch *queue;
+	int quit;		/* The helper threads are being stopped */
+};
+
+void copy_init(struct copy_engine *engine);
+
+/* Stop the helper threads */
+void copy_exit(struct copy_engine *engine);
+
+/* Set the number of helper threads and the unit size, 0 for the default.
+   Returns 0 on success, -1 on error. */
+int copy_set_threads(struct copy_engine *engine, int nr_threads, size_t chunk);
+
+void copy_batch_init(struct copy_batch *batch);
+
+/* Add a copy of rows of row_bytes to the batch. Nothing is copied if src is
+   NULL or the same as dst. */
+void copy_add(
+	struct copy_batch *batch,
+	void *dst,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride);
+
+/* Add a copy that splits rows of row_bytes into the even bytes, written to
+   dst_even, and the odd bytes, written to dst_odd. Both destinations have a
+   stride of dst_stride. Used to deinterleave packed 4:2:2. */
+void copy_add_split(
+	struct copy_batch *batch,
+	void *dst_even,
+	void *dst_odd,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride);
+
+/* Add a copy of rows of row_bytes with the bytes of each 16-bit word
+   swapped. Used to turn CrCb into CbCr. */
+void copy_add_swap16(
+	struct copy_batch *batch,
+	void *dst,
+	const void *src,
+	size_t row_bytes,
+	int rows,
+	size_t dst_stride,
+	size_t src_stride);
+
+/* Copy all planes in the batch, returning when they have been copied.
+   Returns 0 on success, or -1 if too many planes were added, in which case
+   nothing is copied. */
+int copy_run(struct copy_engine *engine, struct copy_batch *batch);
+
+#endif /* __COPY_H__ */
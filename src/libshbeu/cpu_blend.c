@@ -0,0 +1,751 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The blend is done the same way as the hardware does it:
+ *  - src1 is the parent surface and defines the size of the output.
+ *  - src2 and src3 are overlaid on src1 at their (x,y) position, in order.
+ *  - Only one input can be converted to the colorspace used for blending.
+ *  - The result is converted to the output colorspace, with dithering if
+ *    YCbCr is converted to RGB565.
+ *
+ * The output is processed in tiles small enough to stay in the data cache.
+ * All layers are blended into a tile before it is written out. Pixels are
+ * held as 3 x 8-bit components (RGB or YCbCr) in a 32-bit word.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON_SIMD
+#include <arm_neon.h>
+#if !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+#include "cpu_blend.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define debug_info(s) fprintf(stderr, "%s: %s\n", __func__, s)
+#else
+#define debug_info(s)
+#endif
+
+#define TILE_W 256
+#define TILE_H 16
+
+#define SPACE_RGB   0
+#define SPACE_YCBCR 1
+
+typedef void (*blend_row_fn)(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n);
+
+static void blend_row_c(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n);
+static blend_row_fn blend_row = blend_row_c;
+
+
+static inline int clamp8(int v)
+{
+	if (v < 0) return 0;
+	if (v > 255) return 255;
+	return v;
+}
+
+static inline uint32_t pack(int c0, int c1, int c2)
+{
+	return (c0 << 16) | (c1 << 8) | c2;
+}
+
+/* BT.601, Y[16,235], CbCr[16,240] */
+static inline uint32_t ycbcr_to_rgb(uint32_t p)
+{
+	int y = 298 * ((int)((p >> 16) & 0xFF) - 16);
+	int cb = (int)((p >> 8) & 0xFF) - 128;
+	int cr = (int)(p & 0xFF) - 128;
+
+	return pack(clamp8((y + 409*cr + 128) >> 8),
+	            clamp8((y - 100*cb - 208*cr + 128) >> 8),
+	            clamp8((y + 516*cb + 128) >> 8));
+}
+
+static inline uint32_t rgb_to_ycbcr(uint32_t p)
+{
+	int r = (p >> 16) & 0xFF;
+	int g = (p >> 8) & 0xFF;
+	int b = p & 0xFF;
+
+	return pack((( 66*r + 129*g +  25*b + 128) >> 8) + 16,
+	            ((-38*r -  74*g + 112*b + 128) >> 8) + 128,
+	            ((112*r -  94*g -  18*b + 128) >> 8) + 128);
+}
+
+static void convert_row(uint32_t *p, int n, int from, int to)
+{
+	int i;
+
+	if (from == to)
+		return;
+
+	if (to == SPACE_RGB) {
+		for (i=0; i<n; i++)
+			p[i] = ycbcr_to_rgb(p[i]);
+	} else {
+		for (i=0; i<n; i++)
+			p[i] = rgb_to_ycbcr(p[i]);
+	}
+}
+
+static inline int space_of(ren_vid_format_t fmt)
+{
+	return is_ycbcr(fmt) ? SPACE_YCBCR : SPACE_RGB;
+}
+
+
+/* Blend kernels: dst = (src * a + dst * (255 - a)) / 255, rounded */
+
+static void blend_row_c(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n)
+{
+	int i, c;
+
+	for (i=0; i<n; i++) {
+		unsigned int a = alpha[i];
+		uint32_t s = src[i];
+		uint32_t d = dst[i];
+		uint32_t out = 0;
+
+		if (a == 0)
+			continue;
+		if (a == 255) {
+			dst[i] = s;
+			continue;
+		}
+
+		for (c=0; c<24; c+=8) {
+			unsigned int x = ((s >> c) & 0xFF) * a
+			               + ((d >> c) & 0xFF) * (255 - a) + 128;
+			out |= ((x + (x >> 8)) >> 8) << c;
+		}
+		dst[i] = out;
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static inline __m128i div255_sse2(__m128i x)
+{
+	x = _mm_add_epi16(x, _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+	int i;
+
+	for (i=0; i+4 <= n; i+=4) {
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+		__m128i a, alo, ahi, lo, hi;
+		int a4;
+
+		memcpy(&a4, alpha + i, 4);
+		a = _mm_cvtsi32_si128(a4);
+		a = _mm_unpacklo_epi8(a, a);
+		a = _mm_unpacklo_epi16(a, a);
+		alo = _mm_unpacklo_epi8(a, zero);
+		ahi = _mm_unpackhi_epi8(a, zero);
+
+		lo = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), alo),
+			_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(c255, alo)));
+		hi = _mm_add_epi16(
+			_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), ahi),
+			_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(c255, ahi)));
+
+		d = _mm_packus_epi16(div255_sse2(lo), div255_sse2(hi));
+		_mm_storeu_si128((__m128i *)(dst + i), d);
+	}
+
+	blend_row_c(dst + i, src + i, alpha + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i div255_avx2(__m256i x)
+{
+	x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+	return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i c255 = _mm256_set1_epi16(255);
+	const __m256i rep = _mm256_set1_epi32(0x01010101);
+	int i;
+
+	for (i=0; i+8 <= n; i+=8) {
+		__m256i s = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));
+		__m256i a, alo, ahi, lo, hi;
+
+		a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(alpha + i)));
+		a = _mm256_mullo_epi32(a, rep);
+		alo = _mm256_unpacklo_epi8(a, zero);
+		ahi = _mm256_unpackhi_epi8(a, zero);
+
+		lo = _mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), alo),
+			_mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(c255, alo)));
+		hi = _mm256_add_epi16(
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), ahi),
+			_mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(c255, ahi)));
+
+		d = _mm256_packus_epi16(div255_avx2(lo), div255_avx2(hi));
+		_mm256_storeu_si256((__m256i *)(dst + i), d);
+	}
+
+	blend_row_sse2(dst + i, src + i, alpha + i, n - i);
+}
+#endif /* HAVE_X86_SIMD */
+
+#ifdef HAVE_NEON_SIMD
+static void blend_row_neon(uint32_t *dst, const uint32_t *src, const uint8_t *alpha, int n)
+{
+	int i;
+
+	for (i=0; i+4 <= n; i+=4) {
+		uint8x16_t s = vreinterpretq_u8_u32(vld1q_u32(src + i));
+		uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+		uint8x16_t a, ia;
+		uint16x8_t lo, hi;
+		uint32x4_t a32;
+		uint32_t a4;
+
+		memcpy(&a4, alpha + i, 4);
+		a32 = vmovl_u16(vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(a4)))));
+		a = vreinterpretq_u8_u32(vmulq_n_u32(a32, 0x01010101));
+		ia = vmvnq_u8(a);
+
+		lo = vmull_u8(vget_low_u8(s), vget_low_u8(a));
+		lo = vmlal_u8(lo, vget_low_u8(d), vget_low_u8(ia));
+		hi = vmull_u8(vget_high_u8(s), vget_high_u8(a));
+		hi = vmlal_u8(hi, vget_high_u8(d), vget_high_u8(ia));
+
+		/* (x + ((x + 128) >> 8) + 128) >> 8 is x/255, rounded */
+		d = vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+		                vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+		vst1q_u32(dst + i, vreinterpretq_u32_u8(d));
+	}
+
+	blend_row_c(dst + i, src + i, alpha + i, n - i);
+}
+#endif /* HAVE_NEON_SIMD */
+
+void cpu_blend_init(void)
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		blend_row = blend_row_avx2;
+		debug_info("Using AVX2");
+	} else if (__builtin_cpu_supports("sse2")) {
+		blend_row = blend_row_sse2;
+		debug_info("Using SSE2");
+	}
+#endif
+#ifdef HAVE_NEON_SIMD
+#if defined(__aarch64__)
+	blend_row = blend_row_neon;
+#else
+	if (getauxval(AT_HWCAP) & HWCAP_NEON)
+		blend_row = blend_row_neon;
+#endif
+	debug_info("Using NEON");
+#endif
+}
+
+
+/* Read n pixels starting at (sx,sy) of the surface, in the requested
+   colorspace. The alpha of each pixel is also returned. */
+static void fetch_row(
+	const struct shbeu_surface *spec,
+	int sx, int sy, int n,
+	uint32_t *out,
+	uint8_t *alpha,
+	int space)
+{
+	const struct ren_vid_surface *s = &spec->s;
+	const uint8_t *p8;
+	const uint16_t *p16;
+	const uint32_t *p32;
+	int i;
+
+	switch (s->format) {
+	case REN_NV12:
+	case REN_NV16:
+	{
+		int cy = (s->format == REN_NV12) ? sy/2 : sy;
+		const uint8_t *c = (const uint8_t *)s->pc + (size_t)cy * s->pitch;
+
+		p8 = (const uint8_t *)s->py + (size_t)sy * s->pitch + sx;
+		for (i=0; i<n; i++) {
+			int cx = (sx + i) & ~1;
+			out[i] = pack(p8[i], c[cx], c[cx+1]);
+		}
+		break;
+	}
+	case REN_NV21:
+	{
+		const uint8_t *c = (const uint8_t *)s->pc + (size_t)(sy/2) * s->pitch;
+
+		p8 = (const uint8_t *)s->py + (size_t)sy * s->pitch + sx;
+		for (i=0; i<n; i++) {
+			int cx = (sx + i) & ~1;
+			out[i] = pack(p8[i], c[cx+1], c[cx]);
+		}
+		break;
+	}
+	case REN_YUYV:
+	case REN_UYVY:
+	{
+		/* Offsets of Y, Cb and Cr in each pair of pixels */
+		int oy = (s->format == REN_YUYV) ? 0 : 1;
+		int oc = (s->format == REN_YUYV) ? 1 : 0;
+
+		p8 = (const uint8_t *)s->py + (size_t)sy * s->pitch * 2;
+		for (i=0; i<n; i++) {
+			int x = sx + i;
+			const uint8_t *pair = p8 + (x & ~1) * 2;
+			out[i] = pack(p8[x*2 + oy], pair[oc], pair[oc + 2]);
+		}
+		break;
+	}
+	case REN_RGB565:
+		p16 = (const uint16_t *)s->py + (size_t)sy * s->pitch + sx;
+		for (i=0; i<n; i++) {
+			int r = (p16[i] >> 11) & 0x1F;
+			int g = (p16[i] >> 5) & 0x3F;
+			int b = p16[i] & 0x1F;
+			out[i] = pack((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+		}
+		break;
+	case REN_RGB24:
+		p8 = (const uint8_t *)s->py + ((size_t)sy * s->pitch + sx) * 3;
+		for (i=0; i<n; i++, p8+=3)
+			out[i] = pack(p8[0], p8[1], p8[2]);
+		break;
+	case REN_BGR24:
+		p8 = (const uint8_t *)s->py + ((size_t)sy * s->pitch + sx) * 3;
+		for (i=0; i<n; i++, p8+=3)
+			out[i] = pack(p8[2], p8[1], p8[0]);
+		break;
+	case REN_RGB32:
+	case REN_ARGB32:
+		p32 = (const uint32_t *)s->py + (size_t)sy * s->pitch + sx;
+		for (i=0; i<n; i++)
+			out[i] = p32[i] & 0xFFFFFF;
+		break;
+	case REN_PAL8:
+		p8 = (const uint8_t *)s->py + (size_t)sy * s->pitch + sx;
+		for (i=0; i<n; i++)
+			out[i] = spec->palette[p8[i]] & 0xFFFFFF;
+		break;
+	default:
+		break;
+	}
+
+	if (alpha) {
+		if (s->pa) {
+			memcpy(alpha, (const uint8_t *)s->pa + (size_t)sy * s->pitch + sx, n);
+		} else if (s->format == REN_ARGB32) {
+			p32 = (const uint32_t *)s->py + (size_t)sy * s->pitch + sx;
+			for (i=0; i<n; i++)
+				alpha[i] = p32[i] >> 24;
+		} else if (s->format == REN_PAL8) {
+			p8 = (const uint8_t *)s->py + (size_t)sy * s->pitch + sx;
+			for (i=0; i<n; i++)
+				alpha[i] = spec->palette[p8[i]] >> 24;
+		} else {
+			memset(alpha, spec->alpha, n);
+		}
+
+		/* Pixels that match the key are transparent */
+		if (spec->flags & SHBEU_KEY) {
+			uint32_t mask = key_mask(s->format);
+			uint32_t key = spec->key & mask;
+
+			for (i=0; i<n; i++) {
+				if ((out[i] & mask) == key)
+					alpha[i] = 0;
+			}
+		}
+	}
+
+	convert_row(out, n, space_of(s->format), space);
+}
+
+/* Read n pixels of the parent starting at (sx,sy). A tiled parent holds a
+   single tile, which is repeated. */
+static void fetch_parent_row(
+	const struct shbeu_surface *spec,
+	int sx, int sy, int n,
+	uint32_t *out,
+	int space)
+{
+	int x, len;
+
+	if (!(spec->flags & SHBEU_TILE)) {
+		fetch_row(spec, sx, sy, n, out, NULL, space);
+		return;
+	}
+
+	for (sy %= spec->tile_h; n > 0; sx += len, out += len, n -= len) {
+		x = sx % spec->tile_w;
+		len = (spec->tile_w - x < n) ? spec->tile_w - x : n;
+		fetch_row(spec, x, sy, len, out, NULL, space);
+	}
+}
+
+static const uint8_t bayer4[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/* Write a tile of pixels at (dx,dy). The pixels are already in the
+   colorspace of the output surface. */
+static void store_tile(
+	const struct shbeu_surface *spec,
+	int dx, int dy, int w, int h,
+	const uint32_t *work,
+	int dither)
+{
+	const struct ren_vid_surface *s = &spec->s;
+	int x, y;
+
+	for (y=0; y<h; y++) {
+		const uint32_t *in = work + y * TILE_W;
+		int row = dy + y;
+		uint8_t *p8;
+		uint16_t *p16;
+		uint32_t *p32;
+
+		switch (s->format) {
+		case REN_NV12:
+		case REN_NV16:
+			p8 = (uint8_t *)s->py + (size_t)row * s->pitch + dx;
+			for (x=0; x<w; x++)
+				p8[x] = in[x] >> 16;
+
+			/* 4:2:0 chroma is output on even rows, from both rows */
+			if (s->format == REN_NV12 && (row & 1) && y > 0)
+				break;
+
+			p8 = (uint8_t *)s->pc + (size_t)(s->format == REN_NV12 ? row/2 : row) * s->pitch;
+			for (x=dx & ~1; x<dx+w; x+=2) {
+				int cb = 0, cr = 0, nr = 0, xi, yi;
+
+				for (yi=0; yi<2; yi++) {
+					const uint32_t *r = work + (y + yi) * TILE_W;
+
+					if (yi && (s->format == REN_NV16 || (row & 1) || y + 1 >= h))
+						break;
+					for (xi=x; xi<x+2; xi++) {
+						if (xi < dx || xi >= dx + w)
+							continue;
+						cb += (r[xi-dx] >> 8) & 0xFF;
+						cr += r[xi-dx] & 0xFF;
+						nr++;
+					}
+				}
+				p8[x]   = (cb + nr/2) / nr;
+				p8[x+1] = (cr + nr/2) / nr;
+			}
+			break;
+		case REN_RGB565:
+			p16 = (uint16_t *)s->py + (size_t)row * s->pitch + dx;
+			for (x=0; x<w; x++) {
+				int r = (in[x] >> 16) & 0xFF;
+				int g = (in[x] >> 8) & 0xFF;
+				int b = in[x] & 0xFF;
+
+				if (dither) {
+					int d = bayer4[row & 3][(dx + x) & 3];
+					r = clamp8(r + (d >> 1));
+					g = clamp8(g + (d >> 2));
+					b = clamp8(b + (d >> 1));
+				}
+				p16[x] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+			}
+			break;
+		case REN_RGB24:
+			p8 = (uint8_t *)s->py + ((size_t)row * s->pitch + dx) * 3;
+			for (x=0; x<w; x++, p8+=3) {
+				p8[0] = in[x] >> 16;
+				p8[1] = in[x] >> 8;
+				p8[2] = in[x];
+			}
+			break;
+		case REN_RGB32:
+			p32 = (uint32_t *)s->py + (size_t)row * s->pitch + dx;
+			memcpy(p32, in, w * sizeof(uint32_t));
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static int check_src(const struct shbeu_surface *spec)
+{
+	if (!spec)
+		return 0;
+
+	if (!spec->s.py || spec->s.format <= REN_UNKNOWN || spec->s.format > REN_NV21) {
+		debug_info("ERR: Invalid surface format!");
+		return -1;
+	}
+	if ((spec->s.format == REN_NV12 || spec->s.format == REN_NV16 ||
+	     spec->s.format == REN_NV21) && !spec->s.pc) {
+		debug_info("ERR: No chroma plane!");
+		return -1;
+	}
+	if (spec->s.format == REN_PAL8 && !spec->palette) {
+		debug_info("ERR: No palette!");
+		return -1;
+	}
+	if (is_rgb(spec->s.format) && spec->s.pa) {
+		debug_info("ERR: RGB with alpha not supported!");
+		return -1;
+	}
+	if ((spec->flags & SHBEU_KEY) && !is_rgb(spec->s.format)) {
+		debug_info("ERR: Colour key needs an RGB surface!");
+		return -1;
+	}
+	if (spec->s.w <= 0 || spec->s.h <= 0) {
+		debug_info("ERR: Width/height invalid!");
+		return -1;
+	}
+	if (spec->flags & SHBEU_TILE) {
+		if (spec->tile_w <= 0 || spec->tile_h <= 0 || spec->s.pitch < spec->tile_w) {
+			debug_info("ERR: Tile size invalid!");
+			return -1;
+		}
+	} else if (spec->s.pitch < spec->s.w) {
+		debug_info("ERR: Width/height invalid!");
+		return -1;
+	}
+	return 0;
+}
+
+static int check_dst(const struct shbeu_surface *spec)
+{
+	const struct ren_vid_surface *s = &spec->s;
+
+	switch (s->format) {
+	case REN_NV12:
+	case REN_NV16:
+		if (!s->pc)
+			return -1;
+		/* fall through */
+	case REN_RGB565:
+	case REN_RGB24:
+	case REN_RGB32:
+		break;
+	default:
+		debug_info("ERR: Invalid surface format!");
+		return -1;
+	}
+	if (!s->py || s->pitch < s->w) {
+		debug_info("ERR: pitch invalid!");
+		return -1;
+	}
+	return 0;
+}
+
+/* Blend an overlay into the tile at (tx,ty) */
+static void blend_overlay(
+	const struct shbeu_surface *ovl,
+	int tx, int ty, int tw, int th,
+	uint32_t *work,
+	int space)
+{
+	uint32_t pix[TILE_W];
+	uint8_t alpha[TILE_W];
+	int x0, x1, y0, y1, y;
+
+	if (!ovl)
+		return;
+
+	/* Nothing to do for a fully transparent surface */
+	if (!ovl->s.pa && ovl->s.format != REN_ARGB32 && ovl->s.format != REN_PAL8 &&
+	    ovl->alpha == 0)
+		return;
+
+	x0 = (ovl->x > tx) ? ovl->x : tx;
+	y0 = (ovl->y > ty) ? ovl->y : ty;
+	x1 = (ovl->x + ovl->s.w < tx + tw) ? ovl->x + ovl->s.w : tx + tw;
+	y1 = (ovl->y + ovl->s.h < ty + th) ? ovl->y + ovl->s.h : ty + th;
+
+	for (y=y0; y<y1 && x0<x1; y++) {
+		fetch_row(ovl, x0 - ovl->x, y - ovl->y, x1 - x0, pix, alpha, space);
+		blend_row(work + (y - ty) * TILE_W + (x0 - tx), pix, alpha, x1 - x0);
+	}
+}
+
+int cpu_blend(
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect)
+{
+	uint32_t work[TILE_W * TILE_H];
+	struct shbeu_surface win[SHBEU_MAX_WINDOWS];
+	struct ren_vid_rect r;
+	int i;
+	int space, out_space, dither;
+	int tx, ty, y;
+
+	if (!src1 || !dest)
+		return -1;
+
+	if (check_src(src1) < 0 || check_src(src2) < 0 || check_src(src3) < 0)
+		return -1;
+	if (check_dst(dest) < 0)
+		return -1;
+
+	/* Windows are opaque, and are placed on the output after the blend */
+	if (nr_windows < 0 || nr_windows > SHBEU_MAX_WINDOWS)
+		return -1;
+	for (i=0; i<nr_windows; i++) {
+		if (check_src(&windows[i]) < 0)
+			return -1;
+		win[i] = windows[i];
+		win[i].alpha = 255;
+		win[i].s.pa = NULL;
+		if (win[i].s.format == REN_ARGB32)
+			win[i].s.format = REN_RGB32;
+	}
+
+	/* The blend is done in the colorspace of the overlays, as only one
+	   input can use the colorspace converter */
+	space = space_of(src1->s.format);
+	if (src2)
+		space = space_of(src2->s.format);
+	if (src2 && src3 && different_colorspace(src2->s.format, src3->s.format))
+		space = space_of(src1->s.format);
+
+	out_space = space_of(dest->s.format);
+	dither = (dest->s.format == REN_RGB565 && space != out_space);
+
+	r.x = 0;
+	r.y = 0;
+	r.w = src1->s.w;
+	r.h = src1->s.h;
+	if (rect) {
+		r = *rect;
+		if (r.x < 0 || r.y < 0 || r.x + r.w > src1->s.w || r.y + r.h > src1->s.h)
+			return -1;
+	}
+
+	for (ty=r.y; ty<r.y+r.h; ty+=TILE_H) {
+		int th = (r.y + r.h - ty < TILE_H) ? r.y + r.h - ty : TILE_H;
+
+		for (tx=r.x; tx<r.x+r.w; tx+=TILE_W) {
+			int tw = (r.x + r.w - tx < TILE_W) ? r.x + r.w - tx : TILE_W;
+
+			for (y=0; y<th; y++)
+				fetch_parent_row(src1, tx, ty + y, tw, work + y * TILE_W, space);
+
+			blend_overlay(src2, tx, ty, tw, th, work, space);
+			blend_overlay(src3, tx, ty, tw, th, work, space);
+
+			for (y=0; y<th; y++)
+				convert_row(work + y * TILE_W, tw, space, out_space);
+
+			for (i=0; i<nr_windows; i++)
+				blend_overlay(&win[i], tx, ty, tw, th, work, out_space);
+
+			store_tile(dest, tx, ty, tw, th, work, dither);
+		}
+	}
+
+	return 0;
+}
+
+int cpu_fill(
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect,
+	uint32_t rgb)
+{
+	uint32_t work[TILE_W * TILE_H];
+	uint32_t color = rgb & 0xFFFFFF;
+	int tx, ty, i;
+
+	if (!dest || !rect || check_dst(dest) < 0)
+		return -1;
+
+	if (rect->x < 0 || rect->y < 0 || rect->w <= 0 || rect->h <= 0 ||
+	    rect->x + rect->w > dest->s.w || rect->y + rect->h > dest->s.h)
+		return -1;
+
+	if (space_of(dest->s.format) == SPACE_YCBCR)
+		color = rgb_to_ycbcr(color);
+
+	/* Every tile is the same, so it is only made once */
+	for (i=0; i<TILE_W * TILE_H; i++)
+		work[i] = color;
+
+	for (ty=rect->y; ty<rect->y+rect->h; ty+=TILE_H) {
+		int th = (rect->y + rect->h - ty < TILE_H) ? rect->y + rect->h - ty : TILE_H;
+
+		for (tx=rect->x; tx<rect->x+rect->w; tx+=TILE_W) {
+			int tw = (rect->x + rect->w - tx < TILE_W) ? rect->x + rect->w - tx : TILE_W;
+
+			store_tile(dest, tx, ty, tw, th, work, 0);
+		}
+	}
+
+	return 0;
+}
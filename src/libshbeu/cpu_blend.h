@@ -0,0 +1,64 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Software implementation of the BEU blend */
+#ifndef __CPU_BLEND_H__
+#define __CPU_BLEND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include "shbeu/shbeu.h"
+
+/* The bits of a colour key that are compared, as a surface format may not
+   hold all the bits of each component */
+static inline uint32_t key_mask(ren_vid_format_t format)
+{
+	return (format == REN_RGB565) ? 0xF8FCF8 : 0xFFFFFF;
+}
+
+/* Select the fastest kernels for this CPU */
+void cpu_blend_init(void);
+
+/* Blend surfaces, following the same rules as the hardware.
+ * A tiled parent (src1) is repeated as it is read, overlays cannot be tiled.
+ * Pixels of keyed overlays that match the key are transparent.
+ * Windows are placed on top of the blended output without blending.
+ * If rect is not NULL, only that part of the parent surface is output.
+ * Returns 0 on success, -1 on error. */
+int cpu_blend(
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *windows,
+	int nr_windows,
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect);
+
+/* Fill part of a surface with a solid colour, given as 0xRRGGBB.
+ * Returns 0 on success, -1 on error. */
+int cpu_fill(
+	const struct shbeu_surface *dest,
+	const struct ren_vid_rect *rect,
+	uint32_t rgb);
+
+#endif /* __CPU_BLEND_H__ */
@@ -0,0 +1,278 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Import of dma-buf file descriptors.
+ *
+ * Each buffer is mapped once, and the bus address of the mapping is
+ * registered with uiomux, so that the surfaces are used by the hardware
+ * without being copied. The bus address is given by the exporter of the
+ * buffer, or found by uiomux if it already knows the memory, and buffers
+ * with no known bus address are rejected. CPU physical addresses, as in
+ * /proc/self/pagemap, are not used as they are not device addresses
+ * behind an IOMMU.
+ *
+ * Mappings are kept after their surfaces are released, as decoders and
+ * cameras cycle through a small set of buffers. A buffer is identified by
+ * its inode, which is not reused while the buffer is mapped.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shbeu_private.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define debug_info(s) fprintf(stderr, "%s: %s\n", __func__, s)
+#else
+#define debug_info(s)
+#endif
+
+/* Bus address of a mapping that uiomux knows, or 0. The whole mapping must
+   be contiguous. */
+static unsigned long uiomux_phys(void *virt, size_t size)
+{
+	unsigned long first, last;
+
+	first = uiomux_all_virt_to_phys(virt);
+	last = uiomux_all_virt_to_phys((uint8_t *)virt + size - 1);
+	if (!first || last != first + size - 1)
+		return 0;
+
+	return first;
+}
+
+/* Free a mapping with no users, to make room for another */
+static int evict_map(SHBEU *pvt)
+{
+	int i;
+
+	for (i=0; i<pvt->nr_dmabufs; i++) {
+		struct beu_dmabuf *map = &pvt->dmabufs[i];
+
+		if (map->refs)
+			continue;
+
+		if (map->registered)
+			uiomux_unregister(map->virt);
+		phys_invalidate(&pvt->phys);
+		munmap(map->virt, map->size);
+		pvt->dmabufs[i] = pvt->dmabufs[--pvt->nr_dmabufs];
+		return 0;
+	}
+
+	return -1;
+}
+
+static struct beu_dmabuf *get_map(SHBEU *pvt, const struct shbeu_dmabuf_plane *plane)
+{
+	struct beu_dmabuf *map;
+	struct stat st;
+	unsigned long phys;
+	off_t size;
+	void *virt;
+	int i, fd = plane->fd, registered = 0;
+
+	if (fstat(fd, &st) < 0)
+		return NULL;
+
+	for (i=0; i<pvt->nr_dmabufs; i++) {
+		map = &pvt->dmabufs[i];
+		if (map->dev == st.st_dev && map->ino == st.st_ino)
+			return map;
+	}
+
+	if (pvt->nr_dmabufs == BEU_MAX_DMABUFS && evict_map(pvt) < 0) {
+		debug_info("ERR: Too many dma-bufs imported");
+		return NULL;
+	}
+
+	/* The size of a dma-buf is found by seeking to the end */
+	size = lseek(fd, 0, SEEK_END);
+	if (size <= 0)
+		return NULL;
+
+	virt = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (virt == MAP_FAILED)
+		return NULL;
+
+	/* The address from the exporter is registered, so that uiomux
+	   translates the mapping like any other buffer */
+	phys = uiomux_phys(virt, size);
+	if (!phys && plane->phys) {
+		if (uiomux_register(virt, plane->phys, size) < 0) {
+			munmap(virt, size);
+			return NULL;
+		}
+		phys = plane->phys;
+		registered = 1;
+	}
+	if (!phys) {
+		debug_info("ERR: Bus address of the dma-buf is not known");
+		munmap(virt, size);
+		return NULL;
+	}
+	phys_invalidate(&pvt->phys);
+	phys_add(&pvt->phys, virt, phys, size);
+
+	map = &pvt->dmabufs[pvt->nr_dmabufs++];
+	map->dev = st.st_dev;
+	map->ino = st.st_ino;
+	map->virt = virt;
+	map->size = size;
+	map->refs = 0;
+	map->registered = registered;
+
+	return map;
+}
+
+static struct beu_dmabuf *find_map(SHBEU *pvt, const void *virt)
+{
+	int i;
+
+	for (i=0; i<pvt->nr_dmabufs; i++) {
+		struct beu_dmabuf *map = &pvt->dmabufs[i];
+		const uint8_t *start = map->virt;
+
+		if ((const uint8_t *)virt >= start && (const uint8_t *)virt < start + map->size)
+			return map;
+	}
+
+	return NULL;
+}
+
+/* Map one plane, returns NULL on error */
+static void *import_plane(SHBEU *pvt, const struct shbeu_dmabuf_plane *plane, size_t len)
+{
+	struct beu_dmabuf *map;
+
+	map = get_map(pvt, plane);
+	if (!map)
+		return NULL;
+
+	if (plane->offset > map->size || len > map->size - plane->offset) {
+		debug_info("ERR: Plane is outside the dma-buf");
+		return NULL;
+	}
+
+	map->refs++;
+	return (uint8_t *)map->virt + plane->offset;
+}
+
+static void release_plane(SHBEU *pvt, void *virt)
+{
+	struct beu_dmabuf *map;
+
+	if (!virt)
+		return;
+
+	map = find_map(pvt, virt);
+	if (map && map->refs)
+		map->refs--;
+}
+
+int
+shbeu_import_dmabuf(
+	SHBEU *pvt,
+	const struct shbeu_dmabuf *buf,
+	struct shbeu_surface *surface)
+{
+	struct ren_vid_surface *s;
+	size_t len_y, len_c;
+
+	if (!pvt || !buf || !surface || buf->y.fd < 0 || buf->pitch < buf->w) {
+		debug_info("ERR: Invalid input - need a Y or RGB plane");
+		return -1;
+	}
+
+	if (pvt->cpu) {
+		debug_info("ERR: No hardware to import to");
+		return -1;
+	}
+
+	memset(surface, 0, sizeof(*surface));
+	surface->alpha = 255;
+	s = &surface->s;
+	s->format = buf->format;
+	s->w = buf->w;
+	s->h = buf->h;
+	s->pitch = buf->pitch;
+
+	len_y = size_y(buf->format, buf->pitch * buf->h);
+	len_c = size_c(buf->format, buf->pitch * buf->h);
+
+	s->py = import_plane(pvt, &buf->y, len_y);
+	if (!s->py)
+		goto err;
+
+	if (is_ycbcr(buf->format) && buf->c.fd >= 0) {
+		s->pc = import_plane(pvt, &buf->c, len_c);
+		if (!s->pc)
+			goto err;
+	}
+
+	if (buf->a.fd >= 0) {
+		s->pa = import_plane(pvt, &buf->a, buf->pitch * buf->h);
+		if (!s->pa)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	shbeu_release_dmabuf(pvt, surface);
+	return -1;
+}
+
+void
+shbeu_release_dmabuf(SHBEU *pvt, struct shbeu_surface *surface)
+{
+	if (!pvt || !surface)
+		return;
+
+	release_plane(pvt, surface->s.py);
+	release_plane(pvt, surface->s.pc);
+	release_plane(pvt, surface->s.pa);
+	surface->s.py = NULL;
+	surface->s.pc = NULL;
+	surface->s.pa = NULL;
+}
+
+void dmabuf_exit(SHBEU *pvt)
+{
+	while (pvt->nr_dmabufs) {
+		pvt->dmabufs[0].refs = 0;
+		evict_map(pvt);
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Who used the BEU last.
+ *
+ * Other users of the BEU can change any of its registers while we do not
+ * hold the lock, so the register shadows could only be trusted while the
+ * lock is held, and the BEU had to be reset every time it was taken.
+ *
+ * Instead, every handle adds one to a count shared by all processes when
+ * it takes the lock, and remembers the new value. If the count still has
+ * that value the next time the handle takes the lock, no other handle has
+ * held the lock in between, and the registers are as the handle left them.
+ * The count is only changed with the lock held, and never repeats.
+ *
+ * Only users of the BEU that go through libshbeu add to the count. The
+ * count is kept in a POSIX shared memory object, and if it cannot be
+ * opened, every handle resets the BEU when it takes the lock, as before.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "owner.h"
+
+#define OWNER_SHM_NAME "/libshbeu-owner"
+
+void owner_init(struct beu_owner *owner)
+{
+	struct stat st;
+	void *map;
+	int fd;
+
+	owner->count = NULL;
+	owner->mine = UINT64_MAX;
+
+	fd = shm_open(OWNER_SHM_NAME, O_RDWR | O_CREAT, 0666);
+	if (fd < 0)
+		return;
+
+	/* Every user of the BEU must be able to update the count */
+	fchmod(fd, 0666);
+
+	if (fstat(fd, &st) < 0 ||
+	    (st.st_size < (off_t)sizeof(uint64_t) && ftruncate(fd, sizeof(uint64_t)) < 0)) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	owner->count = map;
+}
+
+void owner_exit(struct beu_owner *owner)
+{
+	if (owner->count)
+		munmap((void *)owner->count, sizeof(uint64_t));
+	owner->count = NULL;
+}
+
+int owner_take(struct beu_owner *owner)
+{
+	int same;
+
+	if (!owner->count)
+		return 0;
+
+	same = (*owner->count == owner->mine);
+	owner->mine = ++(*owner->count);
+
+	return same;
+}
@@ -0,0 +1,45 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Who used the BEU last */
+#ifndef __OWNER_H__
+#define __OWNER_H__
+
+#include <stdint.h>
+
+struct beu_owner {
+	volatile uint64_t *count;	/* Times the lock was taken, shared */
+	uint64_t mine;			/* The count when this handle took it */
+};
+
+/* Map the shared count. If it cannot be mapped, owner_take() always
+   returns 0. */
+void owner_init(struct beu_owner *owner);
+
+void owner_exit(struct beu_owner *owner);
+
+/* Call when the BEU lock has been taken. Returns 1 if no other handle has
+   taken the lock since this one last held it, 0 if another may have. */
+int owner_take(struct beu_owner *owner);
+
+#endif /* __OWNER_H__ */
@@ -0,0 +1,104 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Cache of virtual to bus address translations.
+ *
+ * Looking up an address in uiomux walks all of its registered regions, and
+ * each plane is looked up when checking whether it needs a bounce buffer
+ * and again when programming the registers. Applications usually blend a
+ * fixed set of buffers, so the translations are cached.
+ *
+ * uiomux cannot tell us the size of the region an address is in, so the
+ * part of a buffer that was looked up is cached, once uiomux has shown both
+ * of its ends have a matching bus address. Parts of a plane, such as strips
+ * and damage rectangles, then use the entry of the whole plane, see
+ * cache_planes() in beu.c. Buffers registered through the library are
+ * cached with their size. A lookup that fails is not cached, as the buffer
+ * may be registered later.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <uiomux/uiomux.h>
+
+#include "phys.h"
+
+void phys_init(struct phys_cache *cache)
+{
+	memset(cache, 0, sizeof(*cache));
+}
+
+void phys_add(struct phys_cache *cache, void *virt, unsigned long phys, size_t size)
+{
+	struct phys_entry *e;
+
+	if (cache->nr_entries < PHYS_CACHE_SIZE) {
+		e = &cache->entries[cache->nr_entries++];
+	} else {
+		e = &cache->entries[cache->next];
+		cache->next = (cache->next + 1) % PHYS_CACHE_SIZE;
+	}
+
+	e->virt = virt;
+	e->size = size;
+	e->phys = phys;
+}
+
+unsigned long phys_lookup(struct phys_cache *cache, void *virt, size_t size)
+{
+	const char *p = virt;
+	unsigned long phys;
+	int i;
+
+	if (!virt)
+		return 0;
+	if (size == 0)
+		size = 1;
+
+	for (i=0; i<cache->nr_entries; i++) {
+		struct phys_entry *e = &cache->entries[i];
+
+		if (p >= e->virt && p + size <= e->virt + e->size) {
+			cache->hits++;
+			return e->phys + (p - e->virt);
+		}
+	}
+
+	cache->misses++;
+	phys = uiomux_all_virt_to_phys(virt);
+	if (!phys || uiomux_all_virt_to_phys((char *)p + size - 1) != phys + size - 1)
+		return 0;
+
+	phys_add(cache, virt, phys, size);
+	return phys;
+}
+
+void phys_invalidate(struct phys_cache *cache)
+{
+	cache->nr_entries = 0;
+	cache->next = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Cache of virtual to bus address translations */
+#ifndef __PHYS_H__
+#define __PHYS_H__
+
+#include <stddef.h>
+
+#define PHYS_CACHE_SIZE 32
+
+struct phys_entry {
+	const char *virt;
+	size_t size;
+	unsigned long phys;
+};
+
+struct phys_cache {
+	struct phys_entry entries[PHYS_CACHE_SIZE];
+	int nr_entries;
+	int next;		/* Entry to replace when the cache is full */
+	unsigned long hits;
+	unsigned long misses;
+};
+
+void phys_init(struct phys_cache *cache);
+
+/* Bus address of the size bytes at virt, or 0 if the hardware cannot
+   access all of them */
+unsigned long phys_lookup(struct phys_cache *cache, void *virt, size_t size);
+
+/* Add a buffer of size bytes at a known bus address */
+void phys_add(struct phys_cache *cache, void *virt, unsigned long phys, size_t size);
+
+/* Forget all translations, when a buffer is registered or unregistered */
+void phys_invalidate(struct phys_cache *cache);
+
+#endif /* __PHYS_H__ */
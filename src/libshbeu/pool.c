@@ -0,0 +1,294 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * A pool of BEUs. Each job is sent to the unit with the least work queued.
+ * Only the public API is used to drive each unit.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "shbeu/shbeu.h"
+
+/* #define DEBUG */
+
+#ifdef DEBUG
+#define debug_info(s) fprintf(stderr, "%s: %s\n", __func__, s)
+#else
+#define debug_info(s)
+#endif
+
+/* Jobs that can be outstanding on a unit: two on the hardware, up to four
+   waiting for their output to be copied back, and one being submitted */
+#define NR_CTX 8
+
+struct pool_unit;
+
+struct job_ctx {
+	struct pool_unit *unit;
+	void (*done)(void *data);
+	void *data;
+};
+
+struct pool_unit {
+	struct shbeu_pool *pool;
+	SHBEU *beu;
+	char name[8];
+	int queued;			/* Jobs submitted but not completed */
+	unsigned long jobs;		/* Jobs completed */
+	unsigned long long busy_us;	/* Time with at least one job queued */
+	unsigned long long busy_since;
+	unsigned int next_ctx;
+	struct job_ctx ctx[NR_CTX];
+};
+
+/* Callbacks may be made on the copy thread of a unit, so the unit counters
+   are locked */
+struct shbeu_pool {
+	pthread_mutex_t lock;
+	int nr_units;
+	unsigned long long start;
+	struct pool_unit units[SHBEU_POOL_MAX_UNITS];
+};
+
+
+static unsigned long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void job_done(void *data)
+{
+	struct job_ctx *ctx = data;
+	struct pool_unit *unit = ctx->unit;
+	struct shbeu_pool *pool = unit->pool;
+	void (*done)(void *) = ctx->done;
+	void *done_data = ctx->data;
+
+	pthread_mutex_lock(&pool->lock);
+	unit->jobs++;
+	if (--unit->queued == 0)
+		unit->busy_us += now_us() - unit->busy_since;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (done)
+		done(done_data);
+}
+
+struct shbeu_pool *shbeu_pool_open(void)
+{
+	struct shbeu_pool *pool;
+	int i;
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return NULL;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	for (i=0; i<SHBEU_POOL_MAX_UNITS; i++) {
+		struct pool_unit *unit = &pool->units[pool->nr_units];
+
+		unit->pool = pool;
+		snprintf(unit->name, sizeof(unit->name), "BEU%d", i);
+		unit->beu = shbeu_open_named(unit->name);
+		if (!unit->beu)
+			continue;
+
+		/* Needed to find out which units are idle without blocking */
+		shbeu_get_fd(unit->beu);
+		pool->nr_units++;
+	}
+
+	/* Platforms with a single BEU do not name it */
+	if (pool->nr_units == 0) {
+		struct pool_unit *unit = &pool->units[0];
+
+		unit->pool = pool;
+		strcpy(unit->name, "BEU");
+		unit->beu = shbeu_open();
+		if (unit->beu) {
+			shbeu_get_fd(unit->beu);
+			pool->nr_units++;
+		}
+	}
+
+	if (pool->nr_units == 0) {
+		debug_info("ERR: No BEU available");
+		pthread_mutex_destroy(&pool->lock);
+		free(pool);
+		return NULL;
+	}
+
+	pool->start = now_us();
+
+	return pool;
+}
+
+void shbeu_pool_close(struct shbeu_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i=0; i<pool->nr_units; i++)
+		shbeu_close(pool->units[i].beu);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool);
+}
+
+int shbeu_pool_nr_units(struct shbeu_pool *pool)
+{
+	return pool ? pool->nr_units : 0;
+}
+
+int shbeu_pool_try_complete(struct shbeu_pool *pool)
+{
+	int i, nr = 0;
+
+	if (!pool)
+		return -1;
+
+	for (i=0; i<pool->nr_units; i++) {
+		while (shbeu_try_complete(pool->units[i].beu) > 0)
+			nr++;
+	}
+
+	return nr;
+}
+
+/* First idle unit, otherwise the unit with the fewest queued jobs and the
+   least busy time */
+static struct pool_unit *pick_unit(struct shbeu_pool *pool)
+{
+	struct pool_unit *best = &pool->units[0];
+	int i;
+
+	shbeu_pool_try_complete(pool);
+
+	pthread_mutex_lock(&pool->lock);
+	for (i=0; i<pool->nr_units; i++) {
+		struct pool_unit *unit = &pool->units[i];
+
+		if (unit->queued == 0) {
+			best = unit;
+			break;
+		}
+
+		if (unit->queued < best->queued ||
+		    (unit->queued == best->queued && unit->busy_us < best->busy_us))
+			best = unit;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return best;
+}
+
+int shbeu_pool_submit(
+	struct shbeu_pool *pool,
+	const struct shbeu_surface *src1,
+	const struct shbeu_surface *src2,
+	const struct shbeu_surface *src3,
+	const struct shbeu_surface *dest,
+	void (*done)(void *data),
+	void *data)
+{
+	struct pool_unit *unit;
+	struct job_ctx *ctx;
+
+	if (!pool)
+		return -1;
+
+	unit = pick_unit(pool);
+
+	ctx = &unit->ctx[unit->next_ctx++ % NR_CTX];
+	ctx->unit = unit;
+	ctx->done = done;
+	ctx->data = data;
+
+	pthread_mutex_lock(&pool->lock);
+	if (unit->queued++ == 0)
+		unit->busy_since = now_us();
+	pthread_mutex_unlock(&pool->lock);
+
+	if (shbeu_submit(unit->beu, src1, src2, src3, dest, job_done, ctx) < 0) {
+		pthread_mutex_lock(&pool->lock);
+		if (--unit->queued == 0)
+			unit->busy_us += now_us() - unit->busy_since;
+		pthread_mutex_unlock(&pool->lock);
+		return -1;
+	}
+
+	return unit - pool->units;
+}
+
+void shbeu_pool_flush(struct shbeu_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	for (i=0; i<pool->nr_units; i++)
+		shbeu_flush(pool->units[i].beu);
+}
+
+int shbeu_pool_get_stats(struct shbeu_pool *pool, int index, struct shbeu_unit_stats *stats)
+{
+	struct pool_unit *unit;
+	unsigned long long now, busy, elapsed;
+
+	if (!pool || !stats || index < 0 || index >= pool->nr_units)
+		return -1;
+
+	unit = &pool->units[index];
+
+	pthread_mutex_lock(&pool->lock);
+	now = now_us();
+	busy = unit->busy_us;
+	if (unit->queued)
+		busy += now - unit->busy_since;
+	elapsed = now - pool->start;
+
+	stats->name = unit->name;
+	stats->queued = unit->queued;
+	stats->jobs = unit->jobs;
+	pthread_mutex_unlock(&pool->lock);
+
+	stats->busy_us = busy;
+	stats->utilisation = elapsed ? (busy * 100) / elapsed : 0;
+
+	return 0;
+}
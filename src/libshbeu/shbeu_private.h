@@ -0,0 +1,239 @@
+/*
+ * libshbeu: A library for controlling SH-Mobile BEU
+ * Copyright (C) 2010 Renesas Electronics Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Internal state of a BEU handle */
+#ifndef __SHBEU_PRIVATE_H__
+#define __SHBEU_PRIVATE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <uiomux/uiomux.h>
+
+#include "shbeu/shbeu.h"
+#include "shbeu_regs.h"
+#include "bounce.h"
+#include "copy.h"
+#include "owner.h"
+#include "phys.h"
+
+struct uio_map {
+	unsigned long address;
+	unsigned long size;
+	void *iomem;
+};
+
+/* Largest width, height and pitch the hardware can handle */
+#define BEU_MAX_SIZE 4092
+
+/* Register values, built in memory and then written to the hardware */
+#define BEU_NR_REGS ((BRCHR / 4) + 1)
+
+struct beu_regs {
+	uint32_t val[BEU_NR_REGS];
+	uint32_t set[(BEU_NR_REGS + 31) / 32];	/* Registers with a value */
+};
+
+/* The values last written to a set of hardware registers */
+struct beu_shadow {
+	struct beu_regs regs;
+	int valid;	/* 0 if the hardware may hold other values */
+};
+
+/* Reads of BSTAR before sleeping between reads, when waiting for the BEU to
+   stop */
+#define BEU_STOP_SPINS 1000
+
+/* One job can be programmed into each register plane */
+#define BEU_NR_JOBS 2
+
+/* Parts of a blend the hardware cannot do (surfaces that are not a multiple of
+   4 pixels), these are blended in software. There are up to two for each
+   overlay and window. */
+#define BEU_MAX_FIXUPS (2 * (2 + SHBEU_MAX_WINDOWS))
+
+/* Bytes in the solid colour tile used by shbeu_fill() */
+#define FILL_TILE_SIZE (4 * 4 * sizeof(uint32_t))
+
+struct beu_fixup {
+	struct shbeu_surface src[3];
+	int nr_srcs;
+	struct shbeu_surface win[SHBEU_MAX_WINDOWS];
+	int nr_windows;
+	struct shbeu_surface dest;
+	struct ren_vid_rect rects[BEU_MAX_FIXUPS];
+	int nr_rects;
+	int fill;		/* The rects are filled with rgb, not blended */
+	uint32_t rgb;
+};
+
+struct beu_job {
+	struct shbeu_surface src1_hw;
+	struct shbeu_surface src2_hw;
+	struct shbeu_surface src3_hw;
+	struct shbeu_surface dest_hw;
+	struct shbeu_surface src1_user;
+	struct shbeu_surface src2_user;
+	struct shbeu_surface src3_user;
+	struct shbeu_surface dest_user;
+	struct shbeu_surface *p_src1_user;
+	struct shbeu_surface *p_src2_user;
+	struct shbeu_surface *p_src3_user;
+	struct shbeu_surface *p_dest_user;
+	struct shbeu_surface win_hw[SHBEU_MAX_WINDOWS];
+	struct shbeu_surface win_user[SHBEU_MAX_WINDOWS];
+	int nr_windows;
+	int plane;		/* PLANE_A or PLANE_B */
+	int partial;		/* More jobs follow for the same blend */
+	struct beu_fixup fixup;	/* Done in software after the hardware */
+	uint32_t start_reg;	/* BESTR value */
+	int uses_clut;		/* Reads the palette in clut[] */
+	void *owned;		/* Bounce buffer returned once the job has finished */
+	size_t owned_len;
+	void (*done)(void *data);
+	void *done_data;
+};
+
+/* Mappings of imported dma-bufs, see dmabuf.c */
+#define BEU_MAX_DMABUFS 32
+
+struct beu_dmabuf {
+	dev_t dev;
+	ino_t ino;
+	void *virt;
+	size_t size;
+	int refs;	/* Planes of imported surfaces in the buffer */
+	int registered;	/* Registered with uiomux by us */
+};
+
+/* Finished jobs waiting for their output to be copied back, see
+   queue_output() */
+#define BEU_NR_TASKS 4
+
+/* Bounce buffers one job can hold: src1, src2, src3, the windows and dest,
+   each with up to 3 planes. By default, the bounce pool keeps enough for
+   every job that can hold them at once, on the hardware or waiting for its
+   output to be copied. */
+#define BEU_BOUNCE_PER_JOB ((4 + SHBEU_MAX_WINDOWS) * 3)
+
+#if (BEU_NR_JOBS + BEU_NR_TASKS) * BEU_BOUNCE_PER_JOB > BOUNCE_MAX_PER_CLASS
+#error "The bounce pool cannot keep the buffers of the queued jobs"
+#endif
+
+struct SHBEU {
+	int cpu;	/* Blend in software, no BEU is used */
+	UIOMux *uiomux;
+	uiomux_resource_t uiores;
+	struct uio_map uio_mmio;
+	struct bounce_pool bounce;
+	struct copy_engine copy;	/* Copies to and from bounce buffers */
+	struct phys_cache phys;		/* Bus addresses of buffers */
+	struct beu_dmabuf dmabufs[BEU_MAX_DMABUFS];
+	int nr_dmabufs;
+	struct beu_job jobs[BEU_NR_JOBS];
+	struct beu_shadow shadow[2];	/* Plane A and plane B */
+	struct beu_shadow ctrl;		/* Registers shared by both planes */
+	struct beu_owner owner;		/* Has another handle used the BEU? */
+	int job_head;	/* Oldest job, this is the one the hardware is running */
+	int nr_jobs;	/* Number of jobs programmed into the hardware */
+	int stalled;	/* The BEU did not stop, the queued jobs were not started */
+	unsigned long nr_queued;	/* Jobs queued since the handle was opened */
+
+	/* Waiting for jobs, see shbeu_set_wait_policy() */
+	int spin_count;
+	int backoff_us;
+	int timeout_ms;
+	struct shbeu_wait_stats wait_stats;
+	unsigned long long irq_us;	/* When the last interrupt was taken */
+	unsigned long long done_us;	/* When the oldest job was seen to finish */
+
+	/* Layers dropped from blends, see cull_layers() */
+	struct shbeu_cull_stats cull_stats;
+
+	/* Solid colour tile used by shbeu_fill(), see there. It is allocated
+	   when first used, so that the hardware reads it without a bounce. */
+	uint32_t *fill_tile;
+	uint32_t fill_color;
+
+	/* The palette of REN_PAL8 jobs, and if the hardware holds it */
+	uint32_t clut[256];
+	int clut_loaded;
+
+	/* Completion events, see shbeu_get_fd() */
+	int event_fd;		/* -1 until requested */
+	pthread_t irq_thread;
+	pthread_mutex_t irq_mutex;
+	pthread_cond_t irq_cond;
+	int irq_armed;		/* Number of started jobs the thread has to wait for */
+	int irq_quit;
+
+	/* Copy back of finished jobs, done without holding the BEU */
+	pthread_t copy_thread;
+	pthread_mutex_t copy_mutex;
+	pthread_cond_t copy_cond;	/* A task has been queued */
+	pthread_cond_t copied_cond;	/* A task has been done */
+	struct beu_job tasks[BEU_NR_TASKS];
+	int task_head;
+	int nr_tasks;
+	int copy_started;
+	int copy_quit;
+};
+
+static inline int is_opaque(const struct shbeu_surface *layer)
+{
+	return (!layer->s.pa && layer->s.format != REN_ARGB32 && layer->s.format != REN_PAL8 &&
+		layer->alpha == 255 && !(layer->flags & SHBEU_KEY));
+}
+
+/* Does the layer contribute anything to a w x h output? */
+static inline int is_visible(const struct shbeu_surface *layer, int w, int h)
+{
+	if (!layer->s.pa && layer->s.format != REN_ARGB32 && layer->s.format != REN_PAL8 &&
+	    layer->alpha == 0)
+		return 0;
+	if (layer->x >= w || layer->y >= h)
+		return 0;
+	if (layer->x + layer->s.w <= 0 || layer->y + layer->s.h <= 0)
+		return 0;
+	return 1;
+}
+
+/* Can the layer be used as the base of a w x h output? */
+static inline int covers(const struct shbeu_surface *layer, int w, int h)
+{
+	return (layer->x == 0 && layer->y == 0 && layer->s.w >= w && layer->s.h >= h);
+}
+
+/* Unmap all imported dma-bufs */
+void dmabuf_exit(SHBEU *pvt);
+
+/* Wait for all blends to finish. Returns -ETIMEDOUT if one does not, and
+   it is left queued. */
+int flush_blends(SHBEU *pvt);
+
+/* Drop the layers of a blend that cannot be seen, see beu.c */
+int cull_layers(SHBEU *pvt, const struct shbeu_surface **src, int nr_src,
+	struct shbeu_surface *base);
+
+#endif /* __SHBEU_PRIVATE_H__ */
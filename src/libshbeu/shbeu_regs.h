@@ -136,6 +136,7 @@
 #define RPKF_RGB24       2
 #define RPKF_BGR24       11
 #define RPKF_RGB16       3
+#define RPKF_CLUT8       4
 
 /* BPKFR */
 #define BPKFR_TM2		(1 << 21)
@@ -148,6 +149,20 @@
 #define WPCK_RGB24       0x15
 #define WPCK_RGB32       0x13
 
+/* BPCCR0 */
+#define BPCCR0_TCE(n)	(1 << ((n) * 8))	/* Transparent colour for input n [0..2] */
+/* BPCCRn1 and BPCCRn2 hold the lowest and highest 0xRRGGBB colour that is
+   transparent on input n */
+
+/* BMWCR0 */
+#define BMWCR0_MWE(n)	(1 << (n))	/* Enable multi-window input n [0..3] */
+
+/* BRCNTR */
+#define BRCNTR_PLANE_EN	(1 << 0)	/* Use register planes A and B */
+
+/* BRCHR */
+#define BRCHR_PLANE_B	(1 << 0)	/* Next start uses Plane B */
+
 /* Others */
 #define BSIFR1_IN1TM	(1 << 13)
 #define BSIFR1_IN1TE 	(1 << 12)
@@ -306,15 +306,25 @@ static void blend(
 	struct shbeu_surface **sources,
 	int nr_inputs)
 {
-	unsigned char *bb_virt = display_get_back_buff_virt(display);
 	int lcd_w = display_get_width(display);
 	int lcd_h = display_get_height(display);
 	struct shbeu_surface dst;
 	int i;
 	struct timespec start;
 
-	/* Clear the back buffer */
-	draw_rect_rgb565(bb_virt, BLACK, 0, 0, lcd_w, lcd_h, lcd_w);
+	/* Clear the back buffer to black on the BEU, before the blend */
+	memset(&dst, 0, sizeof(dst));
+	dst.s.py = (void *)display_get_back_buff_phys(display);
+	dst.flags = SHBEU_PHYS;
+	dst.s.w = lcd_w;
+	dst.s.h = lcd_h;
+	dst.s.pitch = lcd_w;
+	dst.s.format = REN_RGB565;
+	if (shbeu_fill(beu, &dst, NULL, 0x000000, NULL, NULL) < 0) {
+		/* Clear it on the CPU instead */
+		shbeu_wait(beu);
+		draw_rect_rgb565(display_get_back_buff_virt(display), BLACK, 0, 0, lcd_w, lcd_h, lcd_w);
+	}
 
 	/* Limit the size of the images used in blend to the LCD */
 	for (i=0; i<nr_inputs; i++) {
@@ -324,10 +334,10 @@ static void blend(
 			sources[i]->s.h = lcd_h;
 	}
 
-	/* Destination surface info */
-	dst.s.py = bb_virt;
-	dst.s.pc = NULL;
-	dst.s.pa = NULL;
+	/* Destination surface info, the frame buffer address is known */
+	memset(&dst, 0, sizeof(dst));
+	dst.s.py = (void *)display_get_back_buff_phys(display);
+	dst.flags = SHBEU_PHYS;
 	dst.s.w = sources[0]->s.w;
 	dst.s.h = sources[0]->s.h;
 	dst.s.pitch = lcd_w;